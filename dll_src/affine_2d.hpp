@@ -0,0 +1,55 @@
+#pragma once
+
+#include "vector_2d.hpp"
+
+// 2D affine map: (x, y) -> (a * x + b * y + tx, c * x + d * y + ty)
+template <typename T>
+class Affine2 {
+public:
+    // Constructor.
+    Affine2() : a(1), b(0), c(0), d(1), tx(0), ty(0) {}
+    Affine2(T a, T b, T c, T d, T tx, T ty) : a(a), b(b), c(c), d(d), tx(tx), ty(ty) {}
+
+    // Composition. (*this * other)(v) == (*this)(other(v))
+    Affine2 operator*(const Affine2 &other) const {
+        return Affine2(a * other.a + b * other.c, a * other.b + b * other.d, c * other.a + d * other.c,
+                       c * other.b + d * other.d, a * other.tx + b * other.ty + tx, c * other.tx + d * other.ty + ty);
+    }
+
+    Vec2<T> operator()(const Vec2<T> &v) const {
+        return Vec2<T>(a * v.get_x() + b * v.get_y() + tx, c * v.get_x() + d * v.get_y() + ty);
+    }
+
+    // n-fold composition by repeated squaring.
+    Affine2 pow(unsigned int n) const {
+        Affine2 result;
+        Affine2 base = *this;
+
+        while (n != 0) {
+            if (n & 1u)
+                result = base * result;
+
+            base = base * base;
+            n >>= 1;
+        }
+
+        return result;
+    }
+
+    // Getters.
+    T get_a() const { return a; }
+
+    T get_b() const { return b; }
+
+    T get_c() const { return c; }
+
+    T get_d() const { return d; }
+
+    T get_tx() const { return tx; }
+
+    T get_ty() const { return ty; }
+
+private:
+    T a, b, c, d;
+    T tx, ty;
+};
@@ -0,0 +1,69 @@
+#include "arena_memory.hpp"
+
+ArenaMemory::ArenaMemory(uint32_t block_bits, size_t elem_size, uint64_t group_mask) :
+    block_index(group_mask), block_bits(block_bits), elem_size(elem_size), block_size(elem_size << block_bits) {}
+
+void
+ArenaMemory::cleanup_all_handle() {
+    std::unique_lock<std::shared_mutex> lock(mutex);
+
+    // Nothing is referenced any more, so the slabs themselves are returned too.
+    block_index.clear([](uint32_t) {});
+    free_blocks.clear();
+    slabs.clear();
+}
+
+size_t
+ArenaMemory::cleanup_for_key1_mask(uint64_t match_bits, uint64_t mask) {
+    std::unique_lock<std::shared_mutex> lock(mutex);
+
+    return block_index.erase_key1_mask(match_bits, mask, [this](uint32_t block) { free_blocks.push_back(block); });
+}
+
+bool
+ArenaMemory::has_key1(uint64_t key1) const {
+    std::shared_lock<std::shared_mutex> lock(mutex);
+
+    return block_index.has_key1(key1);
+}
+
+bool
+ArenaMemory::has_key_pair(uint64_t key1, uint32_t key2) const {
+    std::shared_lock<std::shared_mutex> lock(mutex);
+
+    uint32_t block_id = key2 >> block_bits;
+    return get_block(key1, block_id) != INVALID_BLOCK;
+}
+
+bool
+ArenaMemory::erase_block(uint64_t key1, uint32_t block_id) {
+    std::unique_lock<std::shared_mutex> lock(mutex);
+
+    return block_index.erase(key1, block_id, [this](uint32_t block) { free_blocks.push_back(block); });
+}
+
+uint32_t
+ArenaMemory::get_block(uint64_t key1, uint32_t block_id) const {
+    const uint32_t *block = block_index.find(key1, block_id);
+    return block ? *block : INVALID_BLOCK;
+}
+
+// Take a block from the free list, or grow the arena by one slab.
+// Blocks are zero filled like a new file mapping, so unwritten elements read back as zero.
+uint32_t
+ArenaMemory::allocate_block() {
+    if (free_blocks.empty()) {
+        uint32_t first = static_cast<uint32_t>(slabs.size()) * SLAB_BLOCKS;
+        slabs.push_back(std::make_unique<std::byte[]>(block_size * SLAB_BLOCKS));
+
+        free_blocks.reserve(free_blocks.size() + SLAB_BLOCKS);
+        for (uint32_t i = SLAB_BLOCKS; i > 0; i--) {
+            free_blocks.push_back(first + i - 1u);
+        }
+    }
+
+    uint32_t block = free_blocks.back();
+    free_blocks.pop_back();
+    std::memset(get_block_ptr(block), 0, block_size);
+    return block;
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+#include "flat_index.hpp"
+
+// In-process storage with the same interface as SharedMemory.
+// Blocks are carved out of pooled, contiguous slabs, so reads and writes never enter the kernel.
+class ArenaMemory {
+public:
+    ArenaMemory(uint32_t block_bits, size_t elem_size, uint64_t group_mask = 0u);
+    ~ArenaMemory() = default;
+
+    ArenaMemory(const ArenaMemory &) = delete;
+    ArenaMemory &operator=(const ArenaMemory &) = delete;
+
+    void cleanup_all_handle();
+    size_t cleanup_for_key1_mask(uint64_t match_bits, uint64_t mask);  // Returns the number of erased blocks.
+    bool has_key1(uint64_t key1) const;
+    bool has_key_pair(uint64_t key1, uint32_t key2) const;
+    bool erase_block(uint64_t key1, uint32_t block_id);
+
+    // Returns true if a new block was created.
+    template <typename T>
+    bool write(uint64_t key1, uint32_t key2, const T &val) {
+        static_assert(std::is_trivially_copyable_v<T>, "ArenaMemory can only store trivially copyable types.");
+        if (sizeof(T) > elem_size)
+            throw std::invalid_argument("The element is larger than the arena element size.");
+
+        std::unique_lock<std::shared_mutex> lock(mutex);
+
+        uint32_t block_id, block_offset;
+        calc_block_pos(key2, block_id, block_offset);
+
+        uint32_t block = get_block(key1, block_id);
+        bool is_newly_created = false;
+        if (block == INVALID_BLOCK) {
+            if (block_id > BlockIndex<uint32_t>::MAX_BLOCK_ID)
+                return false;
+
+            block = allocate_block();
+            block_index.insert(key1, block_id, block);
+            is_newly_created = true;
+        }
+
+        std::memcpy(get_block_ptr(block) + block_offset * elem_size, &val, sizeof(T));
+        return is_newly_created;
+    }
+
+    template <typename T>
+    bool read(uint64_t key1, uint32_t key2, T &val) const {
+        static_assert(std::is_trivially_copyable_v<T>, "ArenaMemory can only store trivially copyable types.");
+        if (sizeof(T) > elem_size)
+            return false;
+
+        std::shared_lock<std::shared_mutex> lock(mutex);
+
+        uint32_t block_id, block_offset;
+        calc_block_pos(key2, block_id, block_offset);
+
+        uint32_t block = get_block(key1, block_id);
+        if (block == INVALID_BLOCK)
+            return false;
+
+        std::memcpy(&val, get_block_ptr(block) + block_offset * elem_size, sizeof(T));
+        return true;
+    }
+
+private:
+    static constexpr uint32_t INVALID_BLOCK = 0xFFFFFFFFu;
+    static constexpr uint32_t SLAB_BLOCKS = 256u;
+
+    // Readers only take a shared lock, so concurrent reads do not serialize.
+    mutable std::shared_mutex mutex;
+
+    BlockIndex<uint32_t> block_index;
+    std::vector<std::unique_ptr<std::byte[]>> slabs;
+    std::vector<uint32_t> free_blocks;
+    uint32_t block_bits;
+    size_t elem_size;
+    size_t block_size;
+
+    void calc_block_pos(uint32_t key, uint32_t &block_id, uint32_t &block_offset) const;
+    uint32_t get_block(uint64_t key1, uint32_t block_id) const;
+    uint32_t allocate_block();
+    std::byte *get_block_ptr(uint32_t block) const;
+};
+
+inline void
+ArenaMemory::calc_block_pos(uint32_t key, uint32_t &block_id, uint32_t &block_offset) const {
+    block_id = key >> block_bits;                    // key / (2 ^ block_bits)
+    block_offset = key & ((1u << block_bits) - 1u);  // key % (2 ^ block_bits)
+}
+
+inline std::byte *
+ArenaMemory::get_block_ptr(uint32_t block) const {
+    return slabs[block / SLAB_BLOCKS].get() + static_cast<size_t>(block % SLAB_BLOCKS) * block_size;
+}
@@ -1,11 +1,54 @@
 #include <tchar.h>
 #include <cstring>
 #include <stdexcept>
+#include <vector>
 #define NOMINMAX
 #include <Windows.h>
 
 #include "aul_utils.hpp"
 
+static TrackValueMemo &
+get_track_memo() {
+    static TrackValueMemo track_memo;
+    return track_memo;
+}
+
+void
+TrackValueMemo::begin_pass(ExEdit::ObjectFilterIndex ofi, int32_t frame_num, int32_t obj_index, bool is_saving) {
+    if (frame_num != curr_frame_num) {
+        if (is_saving && frame_num == curr_frame_num + 1)
+            drop_frames_before(frame_num - KEEP_FRAMES);
+        else
+            values.clear();
+
+        last_obj_indices.clear();
+        curr_frame_num = frame_num;
+    }
+
+    // An object that has already been processed in this frame is being rendered again.
+    uint64_t ofi_key = static_cast<uint32_t>(ofi);
+    const int32_t *last_obj_index = last_obj_indices.find(ofi_key);
+    if (last_obj_index && obj_index <= *last_obj_index) {
+        values.clear();
+        last_obj_indices.clear();
+    }
+
+    last_obj_indices[ofi_key] = obj_index;
+}
+
+void
+TrackValueMemo::drop_frames_before(int32_t frame) {
+    std::vector<uint64_t> stale_keys;
+    values.for_each([&](uint64_t key, float) {
+        if (static_cast<int32_t>((key >> 3) & 0x1FFFFFFFu) < frame)
+            stale_keys.push_back(key);
+    });
+
+    for (uint64_t key : stale_keys) {
+        values.erase(key);
+    }
+}
+
 AulMemory::AulMemory() : efp(nullptr), efpip(nullptr), loaded_filter_table(nullptr), camera_mode(-1), is_saving(false) {
     static uintptr_t exedit_base = get_exedit_base();
 
@@ -70,6 +113,18 @@ ObjectUtils::ObjectUtils() :
     if (sys_info.build != 11003) {
         throw std::runtime_error("AviUtl v1.10 is required.");
     }
+
+    if (ExEdit::is_valid(curr_ofi))
+        get_track_memo().begin_pass(curr_ofi, efpip->frame_num, efpip->obj_index, is_saving);
+}
+
+std::filesystem::path
+ObjectUtils::get_project_path() const {
+    AviUtl::SysInfo sys_info;
+    if (!efpip || !efp->aviutl_exfunc->get_sys_info(efpip->editp, &sys_info) || !sys_info.project_name)
+        return {};
+
+    return std::filesystem::path(sys_info.project_name);
 }
 
 float
@@ -77,54 +132,89 @@ ObjectUtils::calc_track_val(TrackName track_name, int32_t offset_frame, OffsetTy
     if (!ExEdit::is_valid(curr_ofi))
         return 0.0f;
 
-    auto curr_proc_efp = loaded_filter_table[efpip->objectp->filter_param[curr_filter_idx].id];
-    if (!curr_proc_efp->track_gui)
-        return 0.0f;
-
-    int32_t val;
     int32_t frame = offset_type == OffsetType::Current
                           ? std::clamp(efpip->frame_num + offset_frame, efpip->objectp->frame_begin,
                                        efpip->objectp->frame_end)
                           : std::clamp(efpip->objectp->frame_begin + offset_frame, efpip->objectp->frame_begin,
                                        efpip->objectp->frame_end);
-    int track_idx = -1;
-    float track_denom = 1e-1f;
+
+    auto &track_memo = get_track_memo();
+    if (const float *memo_val = track_memo.find(curr_ofi, frame, track_name))
+        return *memo_val;
+
+    auto curr_proc_efp = loaded_filter_table[efpip->objectp->filter_param[curr_filter_idx].id];
+    int track_idx;
+    float track_denom;
+    if (!resolve_track(curr_proc_efp, track_name, track_idx, track_denom))
+        return 0.0f;
+
+    if (track_idx < 0)  // efp->track_gui->invalid == -1
+        return 0.0f;
+
+    int32_t val;
+    float track_val = 0.0f;
+    if (efp->exfunc->calc_trackbar(curr_ofi, frame, 0, &val, reinterpret_cast<char *>(1 + track_idx)))
+        track_val = static_cast<float>(val) * track_denom;
+
+    track_memo.insert(curr_ofi, frame, track_name, track_val);
+    return track_val;
+}
+
+// Evaluated on the main thread like any other trackbar value, so every move mode works.
+void
+ObjectUtils::prefetch_track_vals(int32_t frames) const {
+    if (!ExEdit::is_valid(curr_ofi) || frames <= 0)
+        return;
+
+    // Skip the frames prefetched last time.
+    const auto &track_memo = get_track_memo();
+    int32_t first_offset = 1;
+    int32_t last_offset = std::min(frames, efpip->objectp->frame_end - efpip->frame_num);
+    while (first_offset <= last_offset && track_memo.find(curr_ofi, efpip->frame_num + first_offset, TrackName::X))
+        first_offset++;
+
+    for (int32_t offset = first_offset; offset <= last_offset; offset++) {
+        for (TrackName track_name : {TrackName::X, TrackName::Y, TrackName::Zoom, TrackName::RotationZ,
+                                     TrackName::CenterX, TrackName::CenterY}) {
+            calc_track_val(track_name, offset);
+        }
+    }
+}
+
+// Returns false if the filter has no trackbars. track_idx is -1 if the filter does not have the track.
+bool
+ObjectUtils::resolve_track(const ExEdit::Filter *proc_efp, TrackName track_name, int &track_idx, float &track_denom) {
+    if (!proc_efp->track_gui)
+        return false;
 
     switch (track_name) {
         case TrackName::X:
-            track_idx = curr_proc_efp->track_gui->bx;
+            track_idx = proc_efp->track_gui->bx;
             track_denom = 1e-1f;
             break;
         case TrackName::Y:
-            track_idx = curr_proc_efp->track_gui->by;
+            track_idx = proc_efp->track_gui->by;
             track_denom = 1e-1f;
             break;
         case TrackName::Zoom:
-            track_idx = curr_proc_efp->track_gui->zoom;
+            track_idx = proc_efp->track_gui->zoom;
             track_denom = 1e-2f;
             break;
         case TrackName::RotationZ:
-            track_idx = curr_proc_efp->track_gui->rz;
+            track_idx = proc_efp->track_gui->rz;
             track_denom = 1e-2f;
             break;
         case TrackName::CenterX:
-            track_idx = curr_proc_efp->track_gui->cx;
+            track_idx = proc_efp->track_gui->cx;
             track_denom = 1e-1f;
             break;
         case TrackName::CenterY:
-            track_idx = curr_proc_efp->track_gui->cy;
+            track_idx = proc_efp->track_gui->cy;
             track_denom = 1e-1f;
             break;
         default:
             throw std::invalid_argument("Invalid track name.");
     }
 
-    if (track_idx < 0)  // efp->track_gui->invalid == -1
-        return 0.0f;
-
-    if (efp->exfunc->calc_trackbar(curr_ofi, frame, 0, &val, reinterpret_cast<char *>(1 + track_idx))) {
-        return static_cast<float>(val) * track_denom;
-    } else {
-        return 0.0f;
-    }
+    return true;
 }
@@ -3,11 +3,14 @@
 #include <algorithm>
 #include <cmath>
 #include <cstdint>
+#include <filesystem>
 #include <optional>
 
 #define NOMINMAX
 #include <exedit.hpp>
 
+#include "flat_index.hpp"
+
 enum class TrackName : int {
     X,
     Y,
@@ -22,6 +25,28 @@ enum class OffsetType : int {
     Current
 };
 
+// Memo of trackbar values.
+// A trackbar value only depends on (object, filter, frame, track), so all individual objects of a filter share it within
+// a render pass. While saving, the timeline cannot be edited, so the values are also kept for the following frames.
+// Rendering the same frame again (e.g. after an edit) starts a new pass and drops everything.
+// Only the main thread may use it.
+class TrackValueMemo {
+public:
+    void begin_pass(ExEdit::ObjectFilterIndex ofi, int32_t frame_num, int32_t obj_index, bool is_saving);
+    const float *find(ExEdit::ObjectFilterIndex ofi, int32_t frame, TrackName track_name) const;
+    void insert(ExEdit::ObjectFilterIndex ofi, int32_t frame, TrackName track_name, float val);
+
+private:
+    static constexpr int32_t KEEP_FRAMES = 2;  // Transforms look back up to 2 frames.
+
+    FlatIndex<float> values;
+    FlatIndex<int32_t> last_obj_indices;  // ofi -> obj_index processed last in the pass.
+    int32_t curr_frame_num = -1;
+
+    void drop_frames_before(int32_t frame);
+    static uint64_t make_key(ExEdit::ObjectFilterIndex ofi, int32_t frame, TrackName track_name);
+};
+
 class AulMemory {
 public:
     AulMemory();
@@ -67,6 +92,9 @@ public:
 
     int32_t get_frame_begin() const;
     int32_t get_frame_end() const;
+    int32_t get_layer() const;
+    int32_t get_scene() const;
+    int32_t get_filter_id() const;  // Type of the current filter.
     int32_t get_frame_num() const;
     int32_t get_local_frame() const;
     int32_t get_obj_w() const;
@@ -74,11 +102,13 @@ public:
     const ExEdit::FilterProcInfo::Geometry &get_obj_data() const;
     bool get_is_saving() const;
     uint16_t get_curr_object_idx() const;
+    uint16_t get_curr_filter_idx() const;
     int32_t get_obj_index() const;
     int32_t get_obj_num() const;
     int32_t get_camera_mode() const;
     int32_t get_max_w() const;
     int32_t get_max_h() const;
+    std::filesystem::path get_project_path() const;  // Empty if the project has not been saved.
 
     void set_obj_w(int32_t w);
     void set_obj_h(int32_t h);
@@ -100,6 +130,8 @@ public:
     float calc_track_val(TrackName track_name, int32_t offset_frame = 0,
                          OffsetType offset_type = OffsetType::Current) const;
 
+    void prefetch_track_vals(int32_t frames) const;  // Memoizes the trackbar values of the next frames.
+
 private:
     ExEdit::ObjectFilterIndex curr_ofi;
     uint16_t curr_object_idx;
@@ -107,8 +139,30 @@ private:
     int32_t local_frame;
     int32_t max_w;
     int32_t max_h;
+
+    static bool resolve_track(const ExEdit::Filter *proc_efp, TrackName track_name, int &track_idx,
+                              float &track_denom);
 };
 
+// Functions of Track Value Memo class.
+inline const float *
+TrackValueMemo::find(ExEdit::ObjectFilterIndex ofi, int32_t frame, TrackName track_name) const {
+    return values.find(make_key(ofi, frame, track_name));
+}
+
+inline void
+TrackValueMemo::insert(ExEdit::ObjectFilterIndex ofi, int32_t frame, TrackName track_name, float val) {
+    values[make_key(ofi, frame, track_name)] = val;
+}
+
+// ofi (32 bits) | frame (29 bits) | track (3 bits)
+inline uint64_t
+TrackValueMemo::make_key(ExEdit::ObjectFilterIndex ofi, int32_t frame, TrackName track_name) {
+    return (static_cast<uint64_t>(static_cast<uint32_t>(ofi)) << 32)
+           | (static_cast<uint64_t>(static_cast<uint32_t>(frame) & 0x1FFFFFFFu) << 3)
+           | static_cast<uint64_t>(track_name);
+}
+
 // Functions of AviUtl Pointers class.
 inline bool
 AulMemory::check_exedit_version(uintptr_t exedit_base) const {
@@ -163,6 +217,21 @@ ObjectUtils::get_frame_end() const {
     return efpip->objectp->frame_end;
 }
 
+inline int32_t
+ObjectUtils::get_layer() const {
+    return efpip->objectp->layer_set;
+}
+
+inline int32_t
+ObjectUtils::get_scene() const {
+    return efpip->objectp->scene_set;
+}
+
+inline int32_t
+ObjectUtils::get_filter_id() const {
+    return efpip->objectp->filter_param[curr_filter_idx].id;
+}
+
 inline int32_t
 ObjectUtils::get_frame_num() const {
     return efpip->frame_num;
@@ -198,6 +267,11 @@ ObjectUtils::get_curr_object_idx() const {
     return curr_object_idx;
 }
 
+inline uint16_t
+ObjectUtils::get_curr_filter_idx() const {
+    return curr_filter_idx;
+}
+
 inline int32_t
 ObjectUtils::get_obj_index() const {
     return efpip->obj_index;
@@ -0,0 +1,330 @@
+#include "blur_plan.hpp"
+
+#include <bit>
+#include <cmath>
+
+#include "utils.hpp"
+
+Affine2<float>
+make_offset_map(const Steps &offset) {
+    float cos = std::cos(offset.rz_rad);
+    float sin = std::sin(offset.rz_rad);
+    Affine2<float> rotation(cos, -sin, sin, cos, 0.0f, 0.0f);
+    Affine2<float> move(offset.scale, 0.0f, 0.0f, offset.scale, offset.location.get_x(), offset.location.get_y());
+    return rotation * move;
+}
+
+Affine2<float>
+make_step_matrix(const Steps &step) {
+    float inv_scale = 1.0f / step.scale;
+    float cos = std::cos(step.rz_rad) * inv_scale;
+    float sin = std::sin(step.rz_rad) * inv_scale;
+    return Affine2<float>(cos, sin, -sin, cos, 0.0f, 0.0f);
+}
+
+Affine2<float>
+make_chain_end_map(const Steps &step, int samples) {
+    float n = static_cast<float>(samples);
+    Affine2<float> move(1.0f, 0.0f, 0.0f, 1.0f, -step.location.get_x() * n, -step.location.get_y() * n);
+    return make_step_matrix(step).pow(static_cast<unsigned int>(samples)) * move;
+}
+
+bool
+is_translation_chain(const Steps &step, int samples) {
+    float n = static_cast<float>(samples);
+    return are_equal(step.rz_rad * n, 0.0f) && are_equal(std::log(step.scale) * n, 0.0f);
+}
+
+bool
+can_double_chain(const Steps &step, int samples) {
+    bool is_around_pivot = are_equal(step.location.norm(2) * static_cast<float>(samples), 0.0f);
+    return is_translation_chain(step, samples) || is_around_pivot;
+}
+
+bool
+can_double_plan(const SegmentData<Steps> &steps_data, const SegmentData<int> &samp_data) {
+    if (!steps_data.seg1 || !samp_data.seg1 || !can_double_chain(*steps_data.seg1, *samp_data.seg1))
+        return false;
+
+    if (steps_data.seg2 && samp_data.seg2 && *samp_data.seg2 != 0)
+        return can_double_chain(*steps_data.seg2, *samp_data.seg2);
+
+    return true;
+}
+
+bool
+is_translation_plan(const SegmentData<Steps> &steps_data, const SegmentData<int> &samp_data) {
+    if (!is_translation_chain(*steps_data.seg1, *samp_data.seg1))
+        return false;
+
+    if (steps_data.seg2 && samp_data.seg2 && *samp_data.seg2 != 0)
+        return is_translation_chain(*steps_data.seg2, *samp_data.seg2);
+
+    return true;
+}
+
+bool
+is_polar_chain(const Steps &step, int samples) {
+    float n = static_cast<float>(samples);
+    bool is_around_pivot = are_equal(step.location.norm(2) * n, 0.0f);
+    bool is_rotation_only = are_equal(std::log(step.scale) * n, 0.0f);
+    bool is_zoom_only = are_equal(step.rz_rad * n, 0.0f);
+    return is_around_pivot && is_rotation_only != is_zoom_only;
+}
+
+bool
+is_polar_plan(const SegmentData<Steps> &steps_data, const SegmentData<int> &samp_data) {
+    if (!is_polar_chain(*steps_data.seg1, *samp_data.seg1))
+        return false;
+
+    if (steps_data.seg2 && samp_data.seg2 && *samp_data.seg2 != 0)
+        return is_polar_chain(*steps_data.seg2, *samp_data.seg2);
+
+    return true;
+}
+
+bool
+is_sliding_plan(const SegmentData<Steps> &steps_data, const SegmentData<int> &samp_data) {
+    auto is_sliding_chain = [](const Steps &step, int samples) {
+        return is_translation_chain(step, samples) || is_polar_chain(step, samples);
+    };
+
+    if (!is_sliding_chain(*steps_data.seg1, *samp_data.seg1))
+        return false;
+
+    if (steps_data.seg2 && samp_data.seg2 && *samp_data.seg2 != 0)
+        return is_sliding_chain(*steps_data.seg2, *samp_data.seg2);
+
+    return true;
+}
+
+Affine2<float>
+make_seg2_start_map(const SegmentData<Steps> &steps_data, const SegmentData<int> &samp_data) {
+    return make_chain_end_map(*steps_data.seg1, *samp_data.seg1) * make_offset_map(*steps_data.offset);
+}
+
+SegmentData<Steps>
+scale_plan(const SegmentData<Steps> &steps_data, float factor) {
+    SegmentData<Steps> scaled = steps_data;
+    for (std::optional<Steps> *steps : {&scaled.offset, &scaled.seg1, &scaled.seg2}) {
+        if (*steps)
+            (*steps)->location = (*steps)->location * factor;
+    }
+
+    return scaled;
+}
+
+// A step of the chain starting at the distance r from the pivot moves a sample by at most a * r + b.
+struct StepBound {
+    float a, b;
+};
+
+// uv_i = M^i * (uv_0 - i * pos) stays within g * (|uv_0| + n * |pos|) and M^i * pos within g * |pos|, where
+// g = max(1, scale^-n). One step moves a sample by |(M - I) uv_i - M^(i+1) pos|, and |(M - I) v| = c |v| for any v,
+// because M is a similarity.
+static StepBound
+calc_step_bound(const Steps &step, int samples) {
+    float n = static_cast<float>(samples);
+    float inv_scale = 1.0f / step.scale;
+    float g = std::max(1.0f, std::exp(-n * std::log(step.scale)));
+    float c = std::sqrt(std::max(inv_scale * inv_scale - 2.0f * std::cos(step.rz_rad) * inv_scale + 1.0f, 0.0f));
+    float pos = step.location.norm(2);
+    return StepBound{g * c, g * (c * n * pos + pos)};
+}
+
+// |start_map(v)| is convex, so its maximum over the image is at a corner.
+static float
+calc_max_radius(const Affine2<float> &start_map, const Vec2<float> &size, const Vec2<float> &pivot) {
+    float max_radius = 0.0f;
+    for (const Vec2<float> &corner : {Vec2<float>(0.0f, 0.0f), Vec2<float>(size.get_x(), 0.0f),
+                                      Vec2<float>(0.0f, size.get_y()), size}) {
+        max_radius = std::max(max_radius, start_map(corner - pivot).norm(2));
+    }
+
+    return max_radius;
+}
+
+float
+calc_max_step_length(const Steps &step, int samples, const Affine2<float> &start_map, const Vec2<float> &size,
+                     const Vec2<float> &pivot) {
+    StepBound bound = calc_step_bound(step, samples);
+    return bound.a * calc_max_radius(start_map, size, pivot) + bound.b;
+}
+
+std::vector<PixelRect>
+make_tiles(const Vec2<int> &size, int tile_size) {
+    std::vector<PixelRect> tiles;
+    const int step = std::max(tile_size, 1);
+    for (int y = 0; y < size.get_y(); y += step) {
+        for (int x = 0; x < size.get_x(); x += step)
+            tiles.push_back(PixelRect{x, y, std::min(x + step, size.get_x()), std::min(y + step, size.get_y())});
+    }
+
+    return tiles;
+}
+
+PixelRect
+calc_source_rect(const SegmentData<Steps> &steps_data, const SegmentData<int> &samp_data, const PixelRect &tile,
+                 const Vec2<int> &size, const Vec2<float> &pivot) {
+    const Vec2<float> size_f = static_cast<Vec2<float>>(size);
+    const Affine2<float> offset_map = make_offset_map(*steps_data.offset);
+    std::array<Vec2<float>, 4> corners;
+    for (int i = 0; i < 4; i++) {
+        Vec2<float> corner(static_cast<float>(i % 2 == 0 ? tile.x0 : tile.x1),
+                           static_cast<float>(i < 2 ? tile.y0 : tile.y1));
+        corners[i] = offset_map(corner - pivot);
+    }
+
+    Vec2<float> lo = corners[0];
+    Vec2<float> hi = corners[0];
+    auto extend = [&lo, &hi](const Vec2<float> &v) {
+        lo = Vec2<float>(std::min(lo.get_x(), v.get_x()), std::min(lo.get_y(), v.get_y()));
+        hi = Vec2<float>(std::max(hi.get_x(), v.get_x()), std::max(hi.get_y(), v.get_y()));
+    };
+    for (const Vec2<float> &corner : corners)
+        extend(corner);
+
+    // uv_i = M (uv_(i-1) - M^(i-1) pos)
+    float margin = 0.0f;
+    auto walk = [&](const Steps &step, int samples, const Affine2<float> &start_map) {
+        Affine2<float> step_matrix = make_step_matrix(step);
+        Vec2<float> localized_pos = step.location;
+        for (int i = 0; i < samples; i++) {
+            for (Vec2<float> &corner : corners) {
+                corner = step_matrix(corner - localized_pos);
+                extend(corner);
+            }
+
+            localized_pos = step_matrix(localized_pos);
+        }
+
+        margin = std::max(margin, calc_max_step_length(step, samples, start_map, size_f, pivot));
+    };
+
+    walk(*steps_data.seg1, *samp_data.seg1, offset_map);
+    if (steps_data.seg2 && samp_data.seg2 && *samp_data.seg2 != 0)
+        walk(*steps_data.seg2, *samp_data.seg2, make_seg2_start_map(steps_data, samp_data));
+
+    if (!std::isfinite(lo.get_x() + lo.get_y() + hi.get_x() + hi.get_y() + margin))
+        return PixelRect{0, 0, size.get_x(), size.get_y()};
+
+    // One more pixel for the bilinear footprint.
+    margin += 1.0f;
+    auto to_pixel = [](float value, int limit) {
+        return static_cast<int>(std::clamp(value, 0.0f, static_cast<float>(limit)));
+    };
+    PixelRect rect{to_pixel(std::floor(lo.get_x() + pivot.get_x() - margin), size.get_x()),
+                   to_pixel(std::floor(lo.get_y() + pivot.get_y() - margin), size.get_y()),
+                   to_pixel(std::ceil(hi.get_x() + pivot.get_x() + margin), size.get_x()),
+                   to_pixel(std::ceil(hi.get_y() + pivot.get_y() + margin), size.get_y())};
+
+    return PixelRect{std::min(rect.x0, tile.x0), std::min(rect.y0, tile.y0), std::max(rect.x1, tile.x1),
+                     std::max(rect.y1, tile.y1)};
+}
+
+static AdaptiveChain
+make_adaptive_chain(const Steps &step, int samples, const Affine2<float> &start_map, const Vec2<float> &size,
+                    const Vec2<float> &pivot) {
+    float n = static_cast<float>(samples);
+    float log_scale = std::log(step.scale);
+    StepBound bound = calc_step_bound(step, samples);
+
+    // Without motion, one sample of weight n is exact.
+    float max_step = bound.a * calc_max_radius(start_map, size, pivot) + bound.b;
+    if (!(max_step > 0.0f) || !std::isfinite(max_step))
+        return AdaptiveChain{0.0f, 0.0f, step.rz_rad, log_scale};
+
+    return AdaptiveChain{n * bound.a / max_step, n * bound.b / max_step, step.rz_rad, log_scale};
+}
+
+SegmentData<AdaptiveChain>
+make_adaptive_plan(const SegmentData<Steps> &steps_data, const SegmentData<int> &samp_data, const Vec2<float> &size,
+                   const Vec2<float> &pivot) {
+    SegmentData<AdaptiveChain> plan;
+    plan.seg1 = make_adaptive_chain(*steps_data.seg1, *samp_data.seg1, make_offset_map(*steps_data.offset), size,
+                                    pivot);
+
+    if (steps_data.seg2 && samp_data.seg2 && *samp_data.seg2 != 0) {
+        plan.seg2 = make_adaptive_chain(*steps_data.seg2, *samp_data.seg2, make_seg2_start_map(steps_data, samp_data),
+                                        size, pivot);
+    }
+
+    return plan;
+}
+
+bool
+can_reconstruct_plan(const SegmentData<Steps> &steps_data, const SegmentData<int> &samp_data) {
+    auto is_short_arc = [](const Steps &step, int samples) {
+        return std::abs(step.rz_rad * static_cast<float>(samples)) <= RECONSTRUCT_MAX_ROTATION;
+    };
+
+    if (!steps_data.seg1 || !samp_data.seg1 || !is_short_arc(*steps_data.seg1, *samp_data.seg1))
+        return false;
+
+    if (steps_data.seg2 && samp_data.seg2 && *samp_data.seg2 != 0)
+        return is_short_arc(*steps_data.seg2, *samp_data.seg2);
+
+    return true;
+}
+
+SegmentData<Affine2<float>>
+make_velocity_maps(const SegmentData<Steps> &steps_data, const SegmentData<int> &samp_data) {
+    auto make_velocity_map = [](const Steps &step, int samples) {
+        Affine2<float> end = make_chain_end_map(step, samples);
+        return Affine2<float>(end.get_a() - 1.0f, end.get_b(), end.get_c(), end.get_d() - 1.0f, end.get_tx(),
+                              end.get_ty());
+    };
+
+    SegmentData<Affine2<float>> maps;
+    maps.offset = make_offset_map(*steps_data.offset);
+    maps.seg1 = make_velocity_map(*steps_data.seg1, *samp_data.seg1);
+    if (steps_data.seg2 && samp_data.seg2 && *samp_data.seg2 != 0)
+        maps.seg2 = make_velocity_map(*steps_data.seg2, *samp_data.seg2);
+
+    return maps;
+}
+
+std::array<int, 2>
+calc_reconstruct_taps(const SegmentData<Affine2<float>> &velocity_maps, const SegmentData<int> &samp_data,
+                      const Vec2<float> &lo, const Vec2<float> &hi) {
+    std::array<float, 2> max_length = {0.0f, 0.0f};
+    for (float x : {lo.get_x(), hi.get_x()}) {
+        for (float y : {lo.get_y(), hi.get_y()}) {
+            Vec2<float> u = (*velocity_maps.offset)(Vec2<float>(x, y));
+            Vec2<float> v = (*velocity_maps.seg1)(u);
+            max_length[0] = std::max(max_length[0], v.norm(2));
+            if (velocity_maps.seg2)
+                max_length[1] = std::max(max_length[1], (*velocity_maps.seg2)(u + v).norm(2));
+        }
+    }
+
+    auto calc_taps = [](float length, int samples) {
+        int limit = std::min(RECONSTRUCT_TAPS, samples);
+        if (limit <= 1 || !std::isfinite(length))
+            return std::max(limit, 0);
+
+        return std::clamp(static_cast<int>(std::ceil(length)), 1, limit);
+    };
+
+    std::array<int, 2> taps = {calc_taps(max_length[0], *samp_data.seg1), 0};
+    if (velocity_maps.seg2)
+        taps[1] = calc_taps(max_length[1], *samp_data.seg2);
+
+    return taps;
+}
+
+Affine2<float>
+make_fixed_step_map(const Steps &step) {
+    Affine2<float> move(1.0f, 0.0f, 0.0f, 1.0f, -step.location.get_x(), -step.location.get_y());
+    return make_step_matrix(step) * move;
+}
+
+int
+round_doubling_samples(int samples) {
+    return samples <= 1 ? 1 : static_cast<int>(std::bit_ceil(static_cast<unsigned int>(samples)));
+}
+
+int
+calc_doubling_passes(int samples) {
+    return samples <= 1 ? 0 : std::countr_zero(static_cast<unsigned int>(samples));
+}
@@ -0,0 +1,154 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <vector>
+
+#include "affine_2d.hpp"
+#include "structs.hpp"
+
+// Closed forms of the sample chains in shaders/MotionBlur_K.frag.
+// All maps work on pivot-relative pixel coordinates.
+
+// Offset step: uv -> R(theta) * (uv * scale + pos)
+Affine2<float>
+make_offset_map(const Steps &offset);
+
+// Step matrix M = R(-theta) / scale.
+Affine2<float>
+make_step_matrix(const Steps &step);
+
+// The i-th sample of a chain is uv_i = M^i * (uv_0 - i * pos).
+// This is the map from uv_0 to uv_n.
+Affine2<float>
+make_chain_end_map(const Steps &step, int samples);
+
+// The step matrix of the chain is the identity within the precision of the whole segment.
+bool
+is_translation_chain(const Steps &step, int samples);
+
+// All chains of the plan are pure translations.
+bool
+is_translation_plan(const SegmentData<Steps> &steps_data, const SegmentData<int> &samp_data);
+
+// The chain is a pure rotation or a pure zoom around the pivot, so that it moves the samples along one axis of the
+// polar coordinates: along rings of constant radius, or along rays of constant angle.
+bool
+is_polar_chain(const Steps &step, int samples);
+
+// All chains of the plan are polar chains.
+bool
+is_polar_plan(const SegmentData<Steps> &steps_data, const SegmentData<int> &samp_data);
+
+// Every chain of the plan is a translation or a polar chain. AccumMode::Sliding relies on it.
+bool
+is_sliding_plan(const SegmentData<Steps> &steps_data, const SegmentData<int> &samp_data);
+
+// The same plan on the image scaled by factor. Only the translations are in pixels.
+SegmentData<Steps>
+scale_plan(const SegmentData<Steps> &steps_data, float factor);
+
+// Map from the pivot-relative pixel coordinates to the start of seg2. (seg1 starts at make_offset_map().)
+Affine2<float>
+make_seg2_start_map(const SegmentData<Steps> &steps_data, const SegmentData<int> &samp_data);
+
+// Upper bound of the distance one step of the chain moves a sample anywhere in the image.
+// start_map maps the pivot-relative pixel coordinates to the start of the chain. size and pivot are those of the image.
+float
+calc_max_step_length(const Steps &step, int samples, const Affine2<float> &start_map, const Vec2<float> &size,
+                     const Vec2<float> &pivot);
+
+// Pixels [x0, x1) x [y0, y1).
+struct PixelRect {
+    int x0, y0, x1, y1;
+
+    int get_w() const { return x1 - x0; }
+
+    int get_h() const { return y1 - y0; }
+};
+
+// Tiles of at most tile_size pixels on a side covering the image, row by row.
+std::vector<PixelRect>
+make_tiles(const Vec2<int> &size, int tile_size);
+
+// Pixels of the image the pixels of the tile can fetch, clipped to the image. It contains the tile itself, which the
+// blend reads.
+// The corners of the tile are walked through the chains, because each sample map is affine. Jittered, adaptive and
+// prefiltered samples lie on the path between the samples, so a margin of one step covers them. The reconstruction
+// taps lie on the chord of the whole segment, which stays within the samples.
+PixelRect
+calc_source_rect(const SegmentData<Steps> &steps_data, const SegmentData<int> &samp_data, const PixelRect &tile,
+                 const Vec2<int> &size, const Vec2<float> &pivot);
+
+// Per-pixel sample counts of AccumMode::Adaptive.
+// A step of a chain starting at the distance r from the pivot moves a sample by at most A * r + B pixels.
+// A pixel takes k = ceil(n * (A * r + B) / (A * r_max + B)) samples spaced n / k steps apart, each weighted n / k,
+// so no pixel steps farther than the farthest pixel of the image does with all n samples.
+struct AdaptiveChain {
+    float k_radius, k_const;  // n * A / (A * r_max + B), n * B / (A * r_max + B)
+    float rz_rad, log_scale;  // Of one step, for the step matrix of the stride.
+};
+
+// size and pivot are those of the image. A missing seg2 is left empty.
+SegmentData<AdaptiveChain>
+make_adaptive_plan(const SegmentData<Steps> &steps_data, const SegmentData<int> &samp_data, const Vec2<float> &size,
+                   const Vec2<float> &pivot);
+
+// Samples of a pixel whose chain starts at the distance radius from the pivot.
+inline int
+calc_adaptive_samples(const AdaptiveChain &chain, float radius, int samples) {
+    if (samples <= 1)
+        return samples;
+
+    float count = std::ceil(chain.k_radius * radius + chain.k_const);
+    return count >= static_cast<float>(samples) ? samples : std::max(static_cast<int>(count), 1);
+}
+
+// Velocity field of AccumMode::Reconstruct.
+// The motion is affine, so the velocity of every pixel is known in closed form: a chain starting at u ends at
+// make_chain_end_map(u) = u + W(u). A pixel takes a few taps along the straight line u + t * W(u), t in (0, 1], like
+// the motion blur of games, so the cost does not grow with the samples.
+// A tile of RECONSTRUCT_TILE pixels takes one tap per pixel its fastest pixel moves, up to RECONSTRUCT_TAPS.
+constexpr int RECONSTRUCT_TAPS = 16;
+constexpr int RECONSTRUCT_TILE = 16;
+
+// The line is the chord of the arc a rotation moves along. It strays from the arc by 1 - cos(theta / 2) of the
+// radius, which is about 8 % at RECONSTRUCT_MAX_ROTATION, and a full turn has no chord at all.
+constexpr float RECONSTRUCT_MAX_ROTATION = 0.785398163f;  // pi / 4
+
+// No segment of the plan rotates by more than RECONSTRUCT_MAX_ROTATION.
+bool
+can_reconstruct_plan(const SegmentData<Steps> &steps_data, const SegmentData<int> &samp_data);
+
+// offset: make_offset_map(), seg1, seg2: W of the chains. seg2 starts at the end of seg1. A missing seg2 is left empty.
+SegmentData<Affine2<float>>
+make_velocity_maps(const SegmentData<Steps> &steps_data, const SegmentData<int> &samp_data);
+
+// Taps of seg1 and seg2 for the tile whose pixel centers span lo to hi (pivot-relative). 0 for a missing seg2.
+// |W| is convex, so the fastest pixel of the tile is at one of its corners.
+std::array<int, 2>
+calc_reconstruct_taps(const SegmentData<Affine2<float>> &velocity_maps, const SegmentData<int> &samp_data,
+                      const Vec2<float> &lo, const Vec2<float> &hi);
+
+// The chain is a fixed affine iteration uv_i = A(uv_(i-1)) only for pure translation (M == I) or pure rotation/zoom
+// around the pivot (pos == 0). Recursive doubling relies on it.
+// The test is done on the whole segment, because per-step values of long chains fall below the epsilon of are_equal().
+bool
+can_double_chain(const Steps &step, int samples);
+
+// All segments of the plan can be doubled.
+bool
+can_double_plan(const SegmentData<Steps> &steps_data, const SegmentData<int> &samp_data);
+
+// A with uv_i = A(uv_(i-1)). Only meaningful when can_double_chain() is true.
+Affine2<float>
+make_fixed_step_map(const Steps &step);
+
+// Recursive doubling needs a power of two. Rounding up costs at most one more pass.
+int
+round_doubling_samples(int samples);
+
+// Number of doubling passes for the given (power of two) samples.
+int
+calc_doubling_passes(int samples);
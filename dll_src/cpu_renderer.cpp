@@ -0,0 +1,1509 @@
+#include "cpu_renderer.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <emmintrin.h>
+#include <immintrin.h>
+#include <vector>
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+
+#include "blur_plan.hpp"
+#include "thread_pool.hpp"
+#include "utils.hpp"
+
+// MSVC accepts AVX2 intrinsics in any function. GCC and Clang need the target attribute.
+#if defined(__GNUC__) || defined(__clang__)
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_AVX2
+#endif
+
+// Node of a sheared row at integer a. Between the nodes the row is linear. Within half a texel past the end nodes it is
+// clamped to them, and transparent beyond, as in locate_texels(). Along b it is clamped to the edge.
+struct RowNode {
+    __m128d sum_bg, sum_ra;  // Integral from a = -0.5 to the node. In double, because it adds up thousands of texels.
+    __m128 texel;            // Premultiplied.
+};
+
+// Radii and angles of the pixels of a polar band. The angles are relative to ref_angle, the angle of the first pixel,
+// and within pi of it, so that a band across angle 0 stays one interval.
+struct PolarRange {
+    float radius_lo, radius_hi;
+    float ref_angle;
+    float angle_lo, angle_hi;
+};
+
+namespace {
+constexpr int ROWS_PER_TASK = 16;
+constexpr int TILE_SIZE = 64;  // Work unit of the sample chains. A multiple of RECONSTRUCT_TILE.
+constexpr int PREFILTER_TAP_LIMIT = 64;
+constexpr float INV_255 = 1.0f / 255.0f;
+constexpr float INV_65535 = 1.0f / 65535.0f;
+
+// One sample chain. M = R(-theta) / scale, which is what `uv *= step_rot_mat / step_scale` does in the shader.
+struct ChainStep {
+    float pos_x, pos_y;
+    float m00, m01, m10, m11;
+    int samples;
+    float rz_rad, log_scale;  // For fractional steps.
+};
+
+struct Kernel {
+    const ExEdit::PixelBGRA *src;
+    ExEdit::PixelBGRA *dst;
+    int w, h;
+    float pivot_x, pivot_y;
+
+    // Offset step: uv = R(theta) * (uv * scale + pos).
+    float off_scale, off_pos_x, off_pos_y, off_cos, off_sin;
+
+    ChainStep chains[2];
+    const ExEdit::PixelBGRA *chain_srcs[2];
+    AdaptiveChain adaptive[2];
+    SegmentData<Affine2<float>> velocity_maps;  // AccumMode::Reconstruct. (make_velocity_maps())
+    SegmentData<int> samp_data;
+    int chain_count;
+    float inv_sample_count;
+    bool mix_orig_img;
+    bool is_adaptive;
+    bool is_reconstruct;
+    bool has_jitter;
+};
+
+inline ChainStep
+make_chain_step(const Steps &steps, int samples) {
+    float inv_scale = 1.0f / steps.scale;
+    float cos = std::cos(steps.rz_rad) * inv_scale;
+    float sin = std::sin(steps.rz_rad) * inv_scale;
+    return ChainStep{steps.location.get_x(), steps.location.get_y(), cos, sin, -sin, cos, samples, steps.rz_rad,
+                     std::log(steps.scale)};
+}
+
+// Interleaved gradient noise, same as jitter_noise() in the shader.
+inline float
+jitter_noise(int x, int y) {
+    float f = 0.06711056f * static_cast<float>(x) + 0.00583715f * static_cast<float>(y);
+    f = 52.9829189f * (f - std::floor(f));
+    return f - std::floor(f);
+}
+
+// Move the chain by h steps: (uv, pos) -> (M^h (uv - h pos), M^h pos). Same as shift_chain() in the shader.
+inline void
+shift_chain(const ChainStep &step, float h, float &ux, float &uy, float &lx, float &ly) {
+    float inv_scale = std::exp(-h * step.log_scale);
+    float cos = std::cos(h * step.rz_rad) * inv_scale;
+    float sin = std::sin(h * step.rz_rad) * inv_scale;
+    float dx = ux - h * lx;
+    float dy = uy - h * ly;
+    ux = cos * dx + sin * dy;
+    uy = -sin * dx + cos * dy;
+
+    float nx = cos * lx + sin * ly;
+    ly = -sin * lx + cos * ly;
+    lx = nx;
+}
+
+// Replace the step by its stride of n / k steps for k samples. Returns the weight of a sample.
+inline float
+make_adaptive_stride(ChainStep &step, const AdaptiveChain &chain, float radius) {
+    int count = calc_adaptive_samples(chain, radius, step.samples);
+    if (count >= step.samples)
+        return 1.0f;
+
+    float stride = static_cast<float>(step.samples) / static_cast<float>(count);
+    float inv_scale = std::exp(-stride * chain.log_scale);
+    float cos = std::cos(stride * chain.rz_rad) * inv_scale;
+    float sin = std::sin(stride * chain.rz_rad) * inv_scale;
+    step = ChainStep{step.pos_x * stride, step.pos_y * stride, cos, sin, -sin, cos, count, chain.rz_rad * stride,
+                     chain.log_scale * stride};
+    return stride;
+}
+
+inline int32_t
+load_u32(const ExEdit::PixelBGRA *p) {
+    int32_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+inline __m128
+unpack_texel(int32_t texel) {
+    const __m128i zero = _mm_setzero_si128();
+    __m128i v = _mm_cvtsi32_si128(texel);
+    v = _mm_unpacklo_epi8(v, zero);
+    v = _mm_unpacklo_epi16(v, zero);
+    return _mm_cvtepi32_ps(v);
+}
+
+// Bilinear footprint shared by all fetch paths.
+// Returns false where safe_texture() in the shader returns vec4(0.0).
+struct Footprint {
+    size_t i00, i10, i01, i11;
+    float tx, ty;
+};
+
+inline bool
+locate_texels(int w, int h, float qx, float qy, Footprint &fp) {
+    if (qx < 0.0f || qx > static_cast<float>(w) || qy < 0.0f || qy > static_cast<float>(h))
+        return false;
+
+    // Texel centers sit at i + 0.5. Neighbours past the border are clamped to the edge.
+    float fx = qx - 0.5f;
+    float fy = qy - 0.5f;
+    float x0f = std::floor(fx);
+    float y0f = std::floor(fy);
+    fp.tx = fx - x0f;
+    fp.ty = fy - y0f;
+
+    int x0 = static_cast<int>(x0f);
+    int y0 = static_cast<int>(y0f);
+    int x1 = std::min(x0 + 1, w - 1);
+    int y1 = std::min(y0 + 1, h - 1);
+    x0 = std::max(x0, 0);
+    y0 = std::max(y0, 0);
+
+    size_t row0 = static_cast<size_t>(y0) * w;
+    size_t row1 = static_cast<size_t>(y1) * w;
+    fp.i00 = row0 + x0;
+    fp.i10 = row0 + x1;
+    fp.i01 = row1 + x0;
+    fp.i11 = row1 + x1;
+    return true;
+}
+
+inline __m128
+lerp(const __m128 &a, const __m128 &b, float t) {
+    return _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), _mm_set1_ps(t)));
+}
+
+struct FetchSse2 {
+    static __m128 fetch(const ExEdit::PixelBGRA *src, int w, int h, float qx, float qy) {
+        Footprint fp;
+        if (!locate_texels(w, h, qx, qy, fp))
+            return _mm_setzero_ps();
+
+        __m128 top = lerp(unpack_texel(load_u32(src + fp.i00)), unpack_texel(load_u32(src + fp.i10)), fp.tx);
+        __m128 bottom = lerp(unpack_texel(load_u32(src + fp.i01)), unpack_texel(load_u32(src + fp.i11)), fp.tx);
+        return _mm_mul_ps(lerp(top, bottom, fp.ty), _mm_set1_ps(INV_255));
+    }
+};
+
+// Both horizontal neighbours are widened and interpolated in one 256-bit register.
+struct FetchAvx2 {
+    TARGET_AVX2 static __m128 fetch(const ExEdit::PixelBGRA *src, int w, int h, float qx, float qy) {
+        Footprint fp;
+        if (!locate_texels(w, h, qx, qy, fp))
+            return _mm_setzero_ps();
+
+        __m128i texels = _mm_setr_epi32(load_u32(src + fp.i00), load_u32(src + fp.i10), load_u32(src + fp.i01),
+                                        load_u32(src + fp.i11));
+        __m256 top = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(texels));
+        __m256 bottom = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_unpackhi_epi64(texels, texels)));
+        __m256 column = _mm256_add_ps(top, _mm256_mul_ps(_mm256_sub_ps(bottom, top), _mm256_set1_ps(fp.ty)));
+
+        __m128 left = _mm256_castps256_ps128(column);
+        __m128 right = _mm256_extractf128_ps(column, 1);
+        return _mm_mul_ps(lerp(left, right, fp.tx), _mm_set1_ps(INV_255));
+    }
+};
+
+// Premultiplied 16-bit texels of the doubling passes.
+inline __m128
+load_texel16(const Texel16 *p) {
+    __m128i v = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(p));
+    v = _mm_unpacklo_epi16(v, _mm_setzero_si128());
+    return _mm_mul_ps(_mm_cvtepi32_ps(v), _mm_set1_ps(INV_65535));
+}
+
+inline void
+store_texel16(Texel16 *p, const __m128 &color) {
+    // SSE2 has no unsigned 32 -> 16 bit pack, so the values are shifted into the signed range and back.
+    const __m128i bias32 = _mm_set1_epi32(32768);
+    const __m128i bias16 = _mm_set1_epi16(static_cast<short>(0x8000));
+    __m128 scaled = _mm_mul_ps(_mm_min_ps(_mm_max_ps(color, _mm_setzero_ps()), _mm_set1_ps(1.0f)),
+                               _mm_set1_ps(65535.0f));
+    __m128i v = _mm_sub_epi32(_mm_cvtps_epi32(scaled), bias32);
+    v = _mm_xor_si128(_mm_packs_epi32(v, v), bias16);
+    _mm_storel_epi64(reinterpret_cast<__m128i *>(p), v);
+}
+
+inline __m128
+fetch_texel16(const Texel16 *buffer, int w, int h, float qx, float qy) {
+    Footprint fp;
+    if (!locate_texels(w, h, qx, qy, fp))
+        return _mm_setzero_ps();
+
+    __m128 top = lerp(load_texel16(buffer + fp.i00), load_texel16(buffer + fp.i10), fp.tx);
+    __m128 bottom = lerp(load_texel16(buffer + fp.i01), load_texel16(buffer + fp.i11), fp.tx);
+    return lerp(top, bottom, fp.ty);
+}
+
+// (b, g, r, a) -> (b * a, g * a, r * a, a)
+inline __m128
+premultiply(const __m128 &color) {
+    const __m128 alpha_lane = _mm_castsi128_ps(_mm_setr_epi32(0, 0, 0, -1));
+    const __m128 one_in_alpha = _mm_setr_ps(0.0f, 0.0f, 0.0f, 1.0f);
+    __m128 alpha = _mm_shuffle_ps(color, color, _MM_SHUFFLE(3, 3, 3, 3));
+    __m128 factor = _mm_or_ps(_mm_andnot_ps(alpha_lane, alpha), one_in_alpha);
+    return _mm_mul_ps(color, factor);
+}
+
+inline float
+get_alpha(const __m128 &color) {
+    return _mm_cvtss_f32(_mm_shuffle_ps(color, color, _MM_SHUFFLE(3, 3, 3, 3)));
+}
+
+inline __m128
+clamp01(const __m128 &color) {
+    return _mm_min_ps(_mm_max_ps(color, _mm_setzero_ps()), _mm_set1_ps(1.0f));
+}
+
+inline __m128
+with_alpha(const __m128 &color, float alpha) {
+    const __m128 alpha_lane = _mm_castsi128_ps(_mm_setr_epi32(0, 0, 0, -1));
+    return _mm_or_ps(_mm_andnot_ps(alpha_lane, color), _mm_and_ps(alpha_lane, _mm_set1_ps(alpha)));
+}
+
+// Same as blend() in the shader. (Guessed AviUtl's normal blend.)
+inline __m128
+blend(const __m128 &color1, const __m128 &color2) {
+    float a1 = get_alpha(color1);
+    float a2 = get_alpha(color2);
+    float w1 = a1 * (1.0f - a2);
+    float w2 = a2 * a2;
+    float denominator = w1 + w2;
+
+    __m128 rgb = _mm_setzero_ps();
+    if (denominator > 0.0f) {
+        __m128 sum = _mm_add_ps(_mm_mul_ps(color1, _mm_set1_ps(w1)), _mm_mul_ps(color2, _mm_set1_ps(w2)));
+        rgb = _mm_div_ps(sum, _mm_set1_ps(std::max(denominator, 0.0001f)));
+    }
+
+    return clamp01(with_alpha(rgb, a1 + a2 * (1.0f - a1)));
+}
+
+inline __m128
+unpremultiply(const __m128 &color) {
+    float alpha = get_alpha(color);
+    __m128 rgb = alpha > 0.0f ? _mm_div_ps(color, _mm_set1_ps(std::max(alpha, 0.0001f))) : _mm_setzero_ps();
+    return clamp01(with_alpha(rgb, alpha));
+}
+
+inline void
+store_texel(ExEdit::PixelBGRA *p, const __m128 &color) {
+    __m128i v = _mm_cvtps_epi32(_mm_mul_ps(color, _mm_set1_ps(255.0f)));
+    v = _mm_packs_epi32(v, v);
+    v = _mm_packus_epi16(v, v);
+    int32_t texel = _mm_cvtsi128_si32(v);
+    std::memcpy(p, &texel, sizeof(texel));
+}
+
+// Taps of the chains of AccumMode::Reconstruct for the tile of the pixel (x, y).
+inline std::array<int, 2>
+calc_tile_taps(const Kernel &k, int x, int y) {
+    float lo_x = static_cast<float>(x / RECONSTRUCT_TILE * RECONSTRUCT_TILE) + 0.5f;
+    float lo_y = static_cast<float>(y / RECONSTRUCT_TILE * RECONSTRUCT_TILE) + 0.5f;
+    float hi_x = std::min(lo_x + static_cast<float>(RECONSTRUCT_TILE - 1), static_cast<float>(k.w) - 0.5f);
+    float hi_y = std::min(lo_y + static_cast<float>(RECONSTRUCT_TILE - 1), static_cast<float>(k.h) - 0.5f);
+    return calc_reconstruct_taps(k.velocity_maps, k.samp_data, Vec2<float>(lo_x - k.pivot_x, lo_y - k.pivot_y),
+                                 Vec2<float>(hi_x - k.pivot_x, hi_y - k.pivot_y));
+}
+
+// Taps at u + t W(u), t = (i - jitter) / taps, each weighted samples / taps. Moves u to the end of the chain.
+// A tap past the end wraps to the start, so the taps stay on the line and within calc_source_rect.
+template <typename Fetch>
+inline __m128
+gather_velocity(const Kernel &k, const Affine2<float> &velocity_map, const ExEdit::PixelBGRA *chain_src, int samples,
+                int taps, float jitter, float &ux, float &uy) {
+    Vec2<float> v = velocity_map(Vec2<float>(ux, uy));
+    float vx = v.get_x();
+    float vy = v.get_y();
+    float inv_taps = 1.0f / static_cast<float>(std::max(taps, 1));
+
+    __m128 sum = _mm_setzero_ps();
+    for (int i = 1; i <= taps; i++) {
+        float t = (static_cast<float>(i) - jitter) * inv_taps;
+        if (t > 1.0f)
+            t -= 1.0f;
+        sum = _mm_add_ps(sum, premultiply(Fetch::fetch(chain_src, k.w, k.h, ux + t * vx + k.pivot_x,
+                                                       uy + t * vy + k.pivot_y)));
+    }
+
+    ux += vx;
+    uy += vy;
+    return _mm_mul_ps(sum, _mm_set1_ps(static_cast<float>(samples) * inv_taps));
+}
+
+template <typename Fetch>
+void
+render_tile(const Kernel &k, const PixelRect &tile) {
+    std::array<int, 2> taps = {0, 0};
+    for (int y = tile.y0; y < tile.y1; y++) {
+        for (int x = tile.x0; x < tile.x1; x++) {
+            if (k.is_reconstruct && x % RECONSTRUCT_TILE == 0)
+                taps = calc_tile_taps(k, x, y);
+
+            // Offset.
+            float ux = (static_cast<float>(x) + 0.5f - k.pivot_x) * k.off_scale + k.off_pos_x;
+            float uy = (static_cast<float>(y) + 0.5f - k.pivot_y) * k.off_scale + k.off_pos_y;
+            float rx = k.off_cos * ux - k.off_sin * uy;
+            float ry = k.off_sin * ux + k.off_cos * uy;
+            ux = rx;
+            uy = ry;
+
+            __m128 color = premultiply(Fetch::fetch(k.src, k.w, k.h, ux + k.pivot_x, uy + k.pivot_y));
+            float noise = k.has_jitter ? jitter_noise(x, y) : 0.0f;
+
+            // Sample chains.
+            for (int c = 0; c < k.chain_count; c++) {
+                ChainStep step = k.chains[c];
+                const ExEdit::PixelBGRA *chain_src = k.chain_srcs[c];
+                float weight = 1.0f;
+                if (k.is_adaptive)
+                    weight = make_adaptive_stride(step, k.adaptive[c], std::sqrt(ux * ux + uy * uy));
+
+                float lx = step.pos_x;
+                float ly = step.pos_y;
+
+                // Samples at t = i - jitter, jitter in [-0.5, 0.5). The chain is moved back and forward again, so seg2
+                // starts at the same place. seg2 is shifted by the golden ratio.
+                float jitter = (c == 0 ? noise : noise + 0.618034f - std::floor(noise + 0.618034f)) - 0.5f;
+                if (k.is_reconstruct) {
+                    const Affine2<float> &velocity_map = c == 0 ? *k.velocity_maps.seg1 : *k.velocity_maps.seg2;
+                    color = _mm_add_ps(color, gather_velocity<Fetch>(k, velocity_map, chain_src, step.samples, taps[c],
+                                                                     k.has_jitter ? jitter : 0.0f, ux, uy));
+                    continue;
+                }
+
+                if (k.has_jitter)
+                    shift_chain(step, -jitter, ux, uy, lx, ly);
+
+                for (int i = 0; i < step.samples; i++) {
+                    float dx = ux - lx;
+                    float dy = uy - ly;
+                    ux = step.m00 * dx + step.m01 * dy;
+                    uy = step.m10 * dx + step.m11 * dy;
+
+                    __m128 sample = premultiply(Fetch::fetch(chain_src, k.w, k.h, ux + k.pivot_x, uy + k.pivot_y));
+                    color = _mm_add_ps(color, _mm_mul_ps(sample, _mm_set1_ps(weight)));
+
+                    float nx = step.m00 * lx + step.m01 * ly;
+                    ly = step.m10 * lx + step.m11 * ly;
+                    lx = nx;
+                }
+
+                if (k.has_jitter)
+                    shift_chain(step, jitter, ux, uy, lx, ly);
+            }
+
+            // Un-premultiply and average.
+            float alpha = get_alpha(color);
+            __m128 rgb = alpha > 0.0f ? _mm_div_ps(color, _mm_set1_ps(std::max(alpha, 0.0001f))) : _mm_setzero_ps();
+            color = clamp01(with_alpha(rgb, alpha * k.inv_sample_count));
+
+            size_t index = static_cast<size_t>(y) * k.w + x;
+            if (k.mix_orig_img)
+                color = blend(color, _mm_mul_ps(unpack_texel(load_u32(k.src + index)), _mm_set1_ps(INV_255)));
+
+            store_texel(k.dst + index, color);
+        }
+    }
+}
+
+// P(v) = mean of I(v - t d(v)) over t in [0, 1), d(v) = (M - I) v - M pos. Midpoints of ceil(|d(v)|) taps.
+struct PrefilterPass {
+    const ExEdit::PixelBGRA *src;
+    ExEdit::PixelBGRA *dst;
+    int w, h;
+    float pivot_x, pivot_y;
+    ChainStep step;
+};
+
+template <typename Fetch>
+void
+render_prefilter_rows(const PrefilterPass &pass, int row_begin, int row_end) {
+    const ChainStep &s = pass.step;
+    const float mpos_x = s.m00 * s.pos_x + s.m01 * s.pos_y;
+    const float mpos_y = s.m10 * s.pos_x + s.m11 * s.pos_y;
+
+    for (int y = row_begin; y < row_end; y++) {
+        for (int x = 0; x < pass.w; x++) {
+            float vx = static_cast<float>(x) + 0.5f - pass.pivot_x;
+            float vy = static_cast<float>(y) + 0.5f - pass.pivot_y;
+            float dx = s.m00 * vx + s.m01 * vy - vx - mpos_x;
+            float dy = s.m10 * vx + s.m11 * vy - vy - mpos_y;
+
+            float length = std::sqrt(dx * dx + dy * dy);
+            int taps = std::clamp(static_cast<int>(std::ceil(length)), 1, PREFILTER_TAP_LIMIT);
+            float inv_taps = 1.0f / static_cast<float>(taps);
+
+            __m128 color = _mm_setzero_ps();
+            for (int i = 0; i < taps; i++) {
+                float t = (static_cast<float>(i) + 0.5f) * inv_taps;
+                float qx = vx - t * dx + pass.pivot_x;
+                float qy = vy - t * dy + pass.pivot_y;
+                color = _mm_add_ps(color, premultiply(Fetch::fetch(pass.src, pass.w, pass.h, qx, qy)));
+            }
+
+            // Back to straight alpha, which the renderers premultiply again after the fetch.
+            color = _mm_mul_ps(color, _mm_set1_ps(inv_taps));
+            float alpha = get_alpha(color);
+            __m128 rgb = alpha > 0.0f ? _mm_div_ps(color, _mm_set1_ps(alpha)) : _mm_setzero_ps();
+            store_texel(pass.dst + static_cast<size_t>(y) * pass.w + x, clamp01(with_alpha(rgb, alpha)));
+        }
+    }
+}
+
+// P_(m+1)(v) = (P_m(v) + P_m(A^(2^m) v)) / 2, where P_0 is the premultiplied source.
+// After log2(n) passes, P(v) is the average of the source over v, A v, ..., A^(n-1) v.
+struct DoublingPass {
+    const ExEdit::PixelBGRA *src;  // First pass only.
+    const Texel16 *prev;           // nullptr on the first pass.
+    Texel16 *dst;
+    int w, h;
+    float pivot_x, pivot_y;
+    Affine2<float> map;
+};
+
+template <typename Fetch>
+void
+render_doubling_rows(const DoublingPass &pass, int row_begin, int row_end) {
+    for (int y = row_begin; y < row_end; y++) {
+        for (int x = 0; x < pass.w; x++) {
+            size_t index = static_cast<size_t>(y) * pass.w + x;
+            Vec2<float> q = pass.map(Vec2<float>(static_cast<float>(x) + 0.5f - pass.pivot_x,
+                                                 static_cast<float>(y) + 0.5f - pass.pivot_y));
+            float qx = q.get_x() + pass.pivot_x;
+            float qy = q.get_y() + pass.pivot_y;
+
+            __m128 color;
+            if (pass.prev) {
+                color = _mm_add_ps(load_texel16(pass.prev + index), fetch_texel16(pass.prev, pass.w, pass.h, qx, qy));
+            } else {
+                __m128 here = _mm_mul_ps(unpack_texel(load_u32(pass.src + index)), _mm_set1_ps(INV_255));
+                color = _mm_add_ps(premultiply(here), premultiply(Fetch::fetch(pass.src, pass.w, pass.h, qx, qy)));
+            }
+
+            store_texel16(pass.dst + index, _mm_mul_ps(color, _mm_set1_ps(0.5f)));
+        }
+    }
+}
+
+// color = I(offset(v)) + n1 * P1(A1 offset(v)) + n2 * P2(B offset(v))
+struct CompositePass {
+    const ExEdit::PixelBGRA *src;
+    const Texel16 *seg1;
+    const Texel16 *seg2;
+    ExEdit::PixelBGRA *dst;
+    int w, h;
+    float pivot_x, pivot_y;
+    Affine2<float> offset_map, seg1_map, seg2_map;
+    float seg1_samples, seg2_samples;
+    float inv_sample_count;
+    bool mix_orig_img;
+};
+
+template <typename Fetch>
+void
+render_composite_rows(const CompositePass &pass, int row_begin, int row_end) {
+    for (int y = row_begin; y < row_end; y++) {
+        for (int x = 0; x < pass.w; x++) {
+            Vec2<float> uv = pass.offset_map(Vec2<float>(static_cast<float>(x) + 0.5f - pass.pivot_x,
+                                                         static_cast<float>(y) + 0.5f - pass.pivot_y));
+            __m128 color = premultiply(
+                    Fetch::fetch(pass.src, pass.w, pass.h, uv.get_x() + pass.pivot_x, uv.get_y() + pass.pivot_y));
+
+            Vec2<float> q1 = pass.seg1_map(uv);
+            __m128 seg1 = fetch_texel16(pass.seg1, pass.w, pass.h, q1.get_x() + pass.pivot_x, q1.get_y() + pass.pivot_y);
+            color = _mm_add_ps(color, _mm_mul_ps(seg1, _mm_set1_ps(pass.seg1_samples)));
+
+            if (pass.seg2) {
+                Vec2<float> q2 = pass.seg2_map(uv);
+                __m128 seg2 =
+                        fetch_texel16(pass.seg2, pass.w, pass.h, q2.get_x() + pass.pivot_x, q2.get_y() + pass.pivot_y);
+                color = _mm_add_ps(color, _mm_mul_ps(seg2, _mm_set1_ps(pass.seg2_samples)));
+            }
+
+            float alpha = get_alpha(color);
+            __m128 rgb = alpha > 0.0f ? _mm_div_ps(color, _mm_set1_ps(std::max(alpha, 0.0001f))) : _mm_setzero_ps();
+            color = clamp01(with_alpha(rgb, alpha * pass.inv_sample_count));
+
+            size_t index = static_cast<size_t>(y) * pass.w + x;
+            if (pass.mix_orig_img)
+                color = blend(color, _mm_mul_ps(unpack_texel(load_u32(pass.src + index)), _mm_set1_ps(INV_255)));
+
+            store_texel(pass.dst + index, color);
+        }
+    }
+}
+// P(v) = (1 / n) * integral of I(v - t pos) over t in [-0.5, n - 0.5], the box covered by the n samples
+// I(v), I(v - pos), ..., I(v - (n - 1) pos) of a translation chain.
+// With the major axis a and the minor axis b of pos, each line of the motion is a row of constant r = b - slope * a.
+// The rows are resampled at integer a, linearly in b, and integrated once. A box is then the difference of two
+// integrals, so the cost per pixel depends neither on n nor on the length of pos.
+// A pixel lerps the two rows around its r. So that the lerp does not smear the transparent border along b, the rows
+// are clamped to the edge in b, and the box is clipped to where the line of the pixel itself is inside the source.
+struct SlidingPass {
+    const ExEdit::PixelBGRA *src;
+    Texel16 *dst;
+    int len_a, len_b;
+    size_t stride_a, stride_b;
+    float slope;           // pos_b / pos_a
+    float box_lo, box_hi;  // Ends of the box along a, relative to the pixel.
+    float r_min;           // r of row 0. The rows are one pixel apart.
+    int row_count;
+};
+
+inline void
+build_sliding_row(const SlidingPass &pass, float r, RowNode *row) {
+    const float b_last = static_cast<float>(pass.len_b - 1);
+
+    for (int a = 0; a < pass.len_a; a++) {
+        float b = std::clamp(r + pass.slope * static_cast<float>(a), 0.0f, b_last);
+        float b0f = std::floor(b);
+        int b0 = static_cast<int>(b0f);
+        int b1 = std::min(b0 + 1, pass.len_b - 1);
+        const ExEdit::PixelBGRA *column = pass.src + a * pass.stride_a;
+        __m128 texel = lerp(unpack_texel(load_u32(column + b0 * pass.stride_b)),
+                            unpack_texel(load_u32(column + b1 * pass.stride_b)), b - b0f);
+        texel = premultiply(_mm_mul_ps(texel, _mm_set1_ps(INV_255)));
+
+        // Trapezoids between the nodes, and the clamped half texel before node 0.
+        __m128 area = a == 0 ? _mm_mul_ps(texel, _mm_set1_ps(0.5f))
+                             : _mm_mul_ps(_mm_add_ps(row[a - 1].texel, texel), _mm_set1_ps(0.5f));
+        __m128d prev_bg = a == 0 ? _mm_setzero_pd() : row[a - 1].sum_bg;
+        __m128d prev_ra = a == 0 ? _mm_setzero_pd() : row[a - 1].sum_ra;
+        row[a].sum_bg = _mm_add_pd(prev_bg, _mm_cvtps_pd(area));
+        row[a].sum_ra = _mm_add_pd(prev_ra, _mm_cvtps_pd(_mm_movehl_ps(area, area)));
+        row[a].texel = texel;
+    }
+}
+
+// Integral of the row from -0.5 to a: the sum of a node plus the rest past it.
+struct RowIntegral {
+    __m128d sum_bg, sum_ra;
+    __m128 rest;
+};
+
+inline RowIntegral
+integrate_sliding_row(const RowNode *row, int len_a, float a) {
+    const float last = static_cast<float>(len_a - 1);
+    if (a <= -0.5f)
+        return RowIntegral{_mm_setzero_pd(), _mm_setzero_pd(), _mm_setzero_ps()};
+    if (a < 0.0f)
+        return RowIntegral{_mm_setzero_pd(), _mm_setzero_pd(), _mm_mul_ps(row[0].texel, _mm_set1_ps(a + 0.5f))};
+
+    if (a >= last) {
+        const RowNode &node = row[len_a - 1];
+        return RowIntegral{node.sum_bg, node.sum_ra, _mm_mul_ps(node.texel, _mm_set1_ps(std::min(a - last, 0.5f)))};
+    }
+
+    int i = static_cast<int>(a);
+    float f = a - static_cast<float>(i);
+    const RowNode &node = row[i];
+    __m128 slope = _mm_sub_ps(row[i + 1].texel, node.texel);
+    __m128 rest = _mm_mul_ps(_mm_add_ps(node.texel, _mm_mul_ps(slope, _mm_set1_ps(0.5f * f))), _mm_set1_ps(f));
+    return RowIntegral{node.sum_bg, node.sum_ra, rest};
+}
+
+// (hi - lo) * inv_length
+inline __m128
+average_between(const RowIntegral &lo, const RowIntegral &hi, float inv_length) {
+    __m128 sum = _mm_movelh_ps(_mm_cvtpd_ps(_mm_sub_pd(hi.sum_bg, lo.sum_bg)),
+                               _mm_cvtpd_ps(_mm_sub_pd(hi.sum_ra, lo.sum_ra)));
+    sum = _mm_add_ps(sum, _mm_sub_ps(hi.rest, lo.rest));
+    return _mm_mul_ps(sum, _mm_set1_ps(inv_length));
+}
+
+// Integral of the row over [lo, hi] times inv_length.
+inline __m128
+average_sliding_row(const RowNode *row, int len_a, float lo, float hi, float inv_length) {
+    return average_between(integrate_sliding_row(row, len_a, lo), integrate_sliding_row(row, len_a, hi), inv_length);
+}
+
+// Value of the row at a. A box shorter than 1/64 pixel is this, because its ends are too close for float coordinates.
+inline __m128
+sample_sliding_row(const RowNode *row, int len_a, float a) {
+    const float last = static_cast<float>(len_a - 1);
+    if (a < -0.5f || a > last + 0.5f)
+        return _mm_setzero_ps();
+    if (a <= 0.0f)
+        return row[0].texel;
+    if (a >= last)
+        return row[len_a - 1].texel;
+
+    int i = static_cast<int>(a);
+    return lerp(row[i].texel, row[i + 1].texel, a - static_cast<float>(i));
+}
+
+// Builds the rows band_begin to band_end of the shear into rows and fills the pixels whose r - r_min lies in
+// [band_begin, band_end).
+inline void
+render_sliding_rows(const SlidingPass &pass, std::vector<RowNode> &rows, int band_begin, int band_end) {
+    const size_t row_size = static_cast<size_t>(pass.len_a);
+    rows.resize(std::max(rows.size(), row_size * (band_end - band_begin + 1)));
+    for (int j = band_begin; j <= band_end; j++)
+        build_sliding_row(pass, pass.r_min + static_cast<float>(j), rows.data() + row_size * (j - band_begin));
+
+    const float box_length = pass.box_hi - pass.box_lo;
+    const bool is_point = box_length < 1.0f / 64.0f;
+    const float inv_box_length = is_point ? 0.0f : 1.0f / box_length;
+    const float band_lo = pass.r_min + static_cast<float>(band_begin);
+    const float band_hi = pass.r_min + static_cast<float>(band_end);
+    const float b_max = static_cast<float>(pass.len_b) - 0.5f;
+    const float inv_slope = pass.slope != 0.0f ? 1.0f / pass.slope : 0.0f;
+
+    for (int a = 0; a < pass.len_a; a++) {
+        float af = static_cast<float>(a);
+        float shear = pass.slope * af;
+
+        // The same expressions bound the neighbouring bands, so every pixel is written exactly once.
+        int b_begin = std::max(static_cast<int>(std::ceil(band_lo + shear)), 0);
+        int b_end = std::min(static_cast<int>(std::ceil(band_hi + shear)), pass.len_b);
+        for (int b = b_begin; b < b_end; b++) {
+            float rho = static_cast<float>(b) - shear - pass.r_min;
+            int j = std::clamp(static_cast<int>(std::floor(rho)), band_begin, band_end - 1);
+            float f = std::clamp(rho - static_cast<float>(j), 0.0f, 1.0f);
+
+            // The line b + slope * (a' - a) is inside [-0.5, len_b - 0.5] for a' in [lo, hi].
+            float lo = af + pass.box_lo;
+            float hi = af + pass.box_hi;
+            if (pass.slope != 0.0f) {
+                float to_top = (-0.5f - static_cast<float>(b)) * inv_slope;
+                float to_bottom = (b_max - static_cast<float>(b)) * inv_slope;
+                lo = std::max(lo, af + std::min(to_top, to_bottom));
+                hi = std::min(hi, af + std::max(to_top, to_bottom));
+            }
+
+            const RowNode *row0 = rows.data() + row_size * (j - band_begin);
+            const RowNode *row1 = row0 + row_size;
+            __m128 color = _mm_setzero_ps();
+            if (is_point) {
+                float center = af + 0.5f * (pass.box_lo + pass.box_hi);
+                if (lo <= center && center <= hi) {
+                    color = lerp(sample_sliding_row(row0, pass.len_a, center),
+                                 sample_sliding_row(row1, pass.len_a, center), f);
+                }
+            } else if (lo < hi) {
+                color = lerp(average_sliding_row(row0, pass.len_a, lo, hi, inv_box_length),
+                             average_sliding_row(row1, pass.len_a, lo, hi, inv_box_length), f);
+            }
+
+            store_texel16(pass.dst + a * pass.stride_a + b * pass.stride_b, color);
+        }
+    }
+}
+// P(v) = (1 / n) * integral of I(M^t v) over t in [-0.5, n - 0.5] for a chain without pos, M = R(-theta) / scale.
+// Around the pivot, a pure rotation moves v along its ring by -theta per step, and a pure zoom moves it along its ray
+// by -log(scale) per step in log radius. So the box is one-dimensional in polar coordinates, as in SlidingPass.
+// The rings are a pixel apart and have a node per pixel of circumference. The rays are a pixel apart at the farthest
+// pixel and have a node per pixel of radius. A pixel lerps the boxes of the two rows around it.
+// The pixels are sorted by the band of rows they need, so a task builds only its ROWS_PER_TASK + 1 rows, and only the
+// part of them that the boxes of its pixels reach. (PolarRange)
+struct PolarPass {
+    const ExEdit::PixelBGRA *src;
+    Texel16 *dst;
+    int w, h;
+    float pivot_x, pivot_y;
+    bool is_ring;
+    int row_count;         // Rings of radius 0, 1, ..., or rays of angle 2 pi k / row_count.
+    int ray_nodes;         // Nodes of a ray, at radius 0, 1, ...
+    float box_lo, box_hi;  // Ends of the box relative to the pixel. Angle on rings, log radius on rays.
+    const uint32_t *pixels;
+    const uint32_t *band_offsets;
+    const PolarRange *band_ranges;
+};
+
+// Nodes first to first + count - 1 of a row. A whole ring wraps around, and has nodes + 1 nodes.
+struct RowSpan {
+    int first, count;
+    bool wraps;
+};
+
+constexpr float TWO_PI = 6.28318531f;
+constexpr float PI = 0.5f * TWO_PI;
+
+inline int
+calc_ring_nodes(int ring) {
+    return std::max(static_cast<int>(std::ceil(TWO_PI * static_cast<float>(ring))), 8);
+}
+
+// Radius and angle in [0, 2 pi) of the pixel center.
+inline void
+to_polar(const PolarPass &pass, uint32_t index, float &radius, float &angle) {
+    float vx = static_cast<float>(index % pass.w) + 0.5f - pass.pivot_x;
+    float vy = static_cast<float>(index / pass.w) + 0.5f - pass.pivot_y;
+    radius = std::sqrt(vx * vx + vy * vy);
+    angle = std::atan2(vy, vx);
+    if (angle < 0.0f)
+        angle += TWO_PI;
+}
+
+// Angle minus ref_angle, within pi of 0. Both are in [0, 2 pi).
+inline float
+unwrap_angle(float angle, float ref_angle) {
+    float d = angle - ref_angle;
+    if (d > PI)
+        return d - TWO_PI;
+    if (d < -PI)
+        return d + TWO_PI;
+    return d;
+}
+
+// Row below the pixel. The next row is the ring outside of it, or the ray counterclockwise of it.
+inline int
+calc_polar_row(const PolarPass &pass, float radius, float angle) {
+    if (pass.is_ring)
+        return std::min(static_cast<int>(radius), pass.row_count - 2);
+
+    return std::min(static_cast<int>(angle * static_cast<float>(pass.row_count) / TWO_PI), pass.row_count - 1);
+}
+
+// Nodes of the ring that cover the boxes of the band, in node units from angle 0 unwrapped around range.ref_angle.
+inline RowSpan
+calc_ring_span(const PolarPass &pass, const PolarRange &range, int nodes) {
+    const float to_u = static_cast<float>(nodes) / TWO_PI;
+    const float lo = (range.ref_angle + range.angle_lo + pass.box_lo) * to_u;
+    const float hi = (range.ref_angle + range.angle_hi + pass.box_hi) * to_u;
+    if (hi - lo + 3.0f >= static_cast<float>(nodes))
+        return RowSpan{0, nodes + 1, true};
+
+    int first = static_cast<int>(std::floor(lo));
+    return RowSpan{first, static_cast<int>(std::floor(hi)) + 2 - first, false};
+}
+
+// Nodes of the rays that cover the boxes of the band. A ray starting within the first node starts at the pivot.
+inline RowSpan
+calc_ray_span(const PolarPass &pass, const PolarRange &range) {
+    const int last = pass.ray_nodes - 1;
+    float lo = range.radius_lo * std::exp(pass.box_lo);
+    float hi = std::min(range.radius_hi * std::exp(pass.box_hi) + 2.0f, static_cast<float>(last));
+    int first = std::min(static_cast<int>(lo) - 1, last - 1);
+    if (first <= 1)
+        first = 0;
+
+    return RowSpan{first, std::max(static_cast<int>(hi), first + 1) + 1 - first, false};
+}
+
+inline void
+widen(const __m128 &color, __m128d &bg, __m128d &ra) {
+    bg = _mm_cvtps_pd(color);
+    ra = _mm_cvtps_pd(_mm_movehl_ps(color, color));
+}
+
+// The last node of a wrapping span closes the ring and holds the integral over the whole ring, in node units.
+template <typename Fetch>
+void
+build_ring(const PolarPass &pass, int ring, int nodes, const RowSpan &span, RowNode *row) {
+    const float radius = static_cast<float>(ring);
+    const float step = TWO_PI / static_cast<float>(nodes);
+    const int fetched = span.wraps ? nodes : span.count;
+    for (int k = 0; k < fetched; k++) {
+        float angle = step * static_cast<float>(span.first + k);
+        float qx = pass.pivot_x + radius * std::cos(angle);
+        float qy = pass.pivot_y + radius * std::sin(angle);
+        row[k].texel = premultiply(Fetch::fetch(pass.src, pass.w, pass.h, qx, qy));
+    }
+
+    if (span.wraps)
+        row[nodes].texel = row[0].texel;
+
+    row[0].sum_bg = _mm_setzero_pd();
+    row[0].sum_ra = _mm_setzero_pd();
+    for (int k = 0; k + 1 < span.count; k++) {
+        __m128d bg, ra;
+        widen(_mm_mul_ps(_mm_add_ps(row[k].texel, row[k + 1].texel), _mm_set1_ps(0.5f)), bg, ra);
+        row[k + 1].sum_bg = _mm_add_pd(row[k].sum_bg, bg);
+        row[k + 1].sum_ra = _mm_add_pd(row[k].sum_ra, ra);
+    }
+}
+
+// Position of u in the span: a node and the rest past it. A wrapping span counts the whole turns.
+inline int
+locate_ring_node(const RowSpan &span, int nodes, float u, float &f, float &turns) {
+    float rest_u = u - static_cast<float>(span.first);
+    turns = 0.0f;
+    if (span.wraps) {
+        turns = std::floor(u / static_cast<float>(nodes));
+        rest_u = u - turns * static_cast<float>(nodes);
+    }
+
+    int i = std::clamp(static_cast<int>(std::floor(rest_u)), 0, span.count - 2);
+    f = std::clamp(rest_u - static_cast<float>(i), 0.0f, 1.0f);
+    return i;
+}
+
+// Integral of the ring from the first node to u, unwrapped over whole turns.
+inline RowIntegral
+integrate_ring(const RowNode *row, int nodes, const RowSpan &span, float u) {
+    float f, turns;
+    int i = locate_ring_node(span, nodes, u, f, turns);
+
+    __m128d whole = _mm_set1_pd(static_cast<double>(turns));
+    __m128d bg = _mm_add_pd(row[i].sum_bg, _mm_mul_pd(row[span.count - 1].sum_bg, whole));
+    __m128d ra = _mm_add_pd(row[i].sum_ra, _mm_mul_pd(row[span.count - 1].sum_ra, whole));
+    __m128 slope = _mm_sub_ps(row[i + 1].texel, row[i].texel);
+    __m128 rest = _mm_mul_ps(_mm_add_ps(row[i].texel, _mm_mul_ps(slope, _mm_set1_ps(0.5f * f))), _mm_set1_ps(f));
+    return RowIntegral{bg, ra, rest};
+}
+
+inline __m128
+sample_ring(const RowNode *row, int nodes, const RowSpan &span, float u) {
+    float f, turns;
+    int i = locate_ring_node(span, nodes, u, f, turns);
+    return lerp(row[i].texel, row[i + 1].texel, f);
+}
+
+// Mean of the ring over the box of the pixel at angle.
+inline __m128
+average_ring(const PolarPass &pass, const RowNode *row, int nodes, const RowSpan &span, float angle) {
+    const float to_u = static_cast<float>(nodes) / TWO_PI;
+    const float lo = (angle + pass.box_lo) * to_u;
+    const float hi = (angle + pass.box_hi) * to_u;
+    if (hi - lo < 1.0f / 64.0f)
+        return sample_ring(row, nodes, span, 0.5f * (lo + hi));
+
+    return average_between(integrate_ring(row, nodes, span, lo), integrate_ring(row, nodes, span, hi),
+                           1.0f / (hi - lo));
+}
+
+// A ray holds G(m) = integral of I(r) / r over [max(first, 1), m] at node m, which is a box in log radius.
+// I is linear between the nodes, so G is exact: over [m, r], (I_m - m d) log(r / m) + d (r - m), d = I_(m+1) - I_m.
+template <typename Fetch>
+void
+build_ray(const PolarPass &pass, int ray, const RowSpan &span, RowNode *row) {
+    const float angle = TWO_PI * static_cast<float>(ray) / static_cast<float>(pass.row_count);
+    const float cos = std::cos(angle);
+    const float sin = std::sin(angle);
+    for (int k = 0; k < span.count; k++) {
+        float radius = static_cast<float>(span.first + k);
+        row[k].texel = premultiply(Fetch::fetch(pass.src, pass.w, pass.h, pass.pivot_x + radius * cos,
+                                                pass.pivot_y + radius * sin));
+    }
+
+    row[0].sum_bg = _mm_setzero_pd();
+    row[0].sum_ra = _mm_setzero_pd();
+    for (int k = 0; k + 1 < span.count; k++) {
+        int m = span.first + k;
+        if (m == 0) {
+            row[k + 1].sum_bg = _mm_setzero_pd();
+            row[k + 1].sum_ra = _mm_setzero_pd();
+            continue;
+        }
+
+        float mf = static_cast<float>(m);
+        __m128 slope = _mm_sub_ps(row[k + 1].texel, row[k].texel);
+        __m128 base = _mm_sub_ps(row[k].texel, _mm_mul_ps(slope, _mm_set1_ps(mf)));
+        __m128 area = _mm_add_ps(_mm_mul_ps(base, _mm_set1_ps(std::log1p(1.0f / mf))), slope);
+        __m128d bg, ra;
+        widen(area, bg, ra);
+        row[k + 1].sum_bg = _mm_add_pd(row[k].sum_bg, bg);
+        row[k + 1].sum_ra = _mm_add_pd(row[k].sum_ra, ra);
+    }
+}
+
+// G at exp(log_radius). The source is transparent past the last node of the ray.
+inline RowIntegral
+integrate_ray(const RowNode *row, const RowSpan &span, float log_radius) {
+    const int last = span.first + span.count - 1;
+    float radius = std::exp(log_radius);
+    if (radius >= static_cast<float>(last))
+        return RowIntegral{row[span.count - 1].sum_bg, row[span.count - 1].sum_ra, _mm_setzero_ps()};
+
+    int m = std::max(static_cast<int>(radius), span.first);
+    float mf = static_cast<float>(m);
+    const RowNode &node = row[m - span.first];
+    __m128 slope = _mm_sub_ps(row[m - span.first + 1].texel, node.texel);
+    __m128 base = _mm_sub_ps(node.texel, _mm_mul_ps(slope, _mm_set1_ps(mf)));
+    float log_ratio = m == 0 ? log_radius : log_radius - std::log(mf);
+    float linear = m == 0 ? radius - 1.0f : radius - mf;
+    __m128 rest = _mm_add_ps(_mm_mul_ps(base, _mm_set1_ps(log_ratio)), _mm_mul_ps(slope, _mm_set1_ps(linear)));
+    return RowIntegral{node.sum_bg, node.sum_ra, rest};
+}
+
+inline __m128
+sample_ray(const RowNode *row, const RowSpan &span, float radius) {
+    int m = std::clamp(static_cast<int>(radius), span.first, span.first + span.count - 2);
+    float f = std::clamp(radius - static_cast<float>(m), 0.0f, 1.0f);
+    return lerp(row[m - span.first].texel, row[m - span.first + 1].texel, f);
+}
+
+// Mean of the ray over the box of the pixel at radius.
+inline __m128
+average_ray(const PolarPass &pass, const RowNode *row, const RowSpan &span, float radius) {
+    const float box_length = pass.box_hi - pass.box_lo;
+    if (box_length < 1.0f / 1024.0f || radius < 1.0f / 1024.0f)
+        return sample_ray(row, span, radius);
+
+    float log_radius = std::log(radius);
+    return average_between(integrate_ray(row, span, log_radius + pass.box_lo),
+                           integrate_ray(row, span, log_radius + pass.box_hi), 1.0f / box_length);
+}
+
+// rows and offsets are the scratch of the thread. A band without pixels builds nothing.
+template <typename Fetch>
+void
+render_polar_band(const PolarPass &pass, std::vector<RowNode> &rows, std::vector<size_t> &offsets, int band) {
+    if (pass.band_offsets[band] == pass.band_offsets[band + 1])
+        return;
+
+    const PolarRange &range = pass.band_ranges[band];
+    const int row_begin = band * ROWS_PER_TASK;
+    const int row_end = std::min(row_begin + ROWS_PER_TASK, pass.is_ring ? pass.row_count - 1 : pass.row_count);
+    const RowSpan ray_span = pass.is_ring ? RowSpan{} : calc_ray_span(pass, range);
+    auto span_of = [&](int j) { return pass.is_ring ? calc_ring_span(pass, range, calc_ring_nodes(j)) : ray_span; };
+
+    // Rows row_begin to row_end. The ray after the last one is ray 0 again.
+    offsets.assign(static_cast<size_t>(row_end - row_begin) + 2, 0u);
+    for (int j = row_begin; j <= row_end; j++)
+        offsets[j - row_begin + 1] = offsets[j - row_begin] + static_cast<size_t>(span_of(j).count);
+
+    rows.resize(std::max(rows.size(), offsets.back()));
+    for (int j = row_begin; j <= row_end; j++) {
+        RowNode *row = rows.data() + offsets[j - row_begin];
+        if (pass.is_ring)
+            build_ring<Fetch>(pass, j, calc_ring_nodes(j), span_of(j), row);
+        else
+            build_ray<Fetch>(pass, j % pass.row_count, ray_span, row);
+    }
+
+    for (uint32_t p = pass.band_offsets[band]; p < pass.band_offsets[band + 1]; p++) {
+        uint32_t index = pass.pixels[p];
+        float radius, angle;
+        to_polar(pass, index, radius, angle);
+        int j = std::clamp(calc_polar_row(pass, radius, angle), row_begin, row_end - 1);
+        const RowNode *row0 = rows.data() + offsets[j - row_begin];
+        const RowNode *row1 = rows.data() + offsets[j - row_begin + 1];
+
+        __m128 color;
+        if (pass.is_ring) {
+            // The same unwrapping as the span, so that the box stays within it.
+            float unwrapped = range.ref_angle + unwrap_angle(angle, range.ref_angle);
+            float f = std::clamp(radius - static_cast<float>(j), 0.0f, 1.0f);
+            color = lerp(average_ring(pass, row0, calc_ring_nodes(j), span_of(j), unwrapped),
+                         average_ring(pass, row1, calc_ring_nodes(j + 1), span_of(j + 1), unwrapped), f);
+        } else {
+            float u = angle * static_cast<float>(pass.row_count) / TWO_PI;
+            float f = std::clamp(u - static_cast<float>(j), 0.0f, 1.0f);
+            color = lerp(average_ray(pass, row0, ray_span, radius), average_ray(pass, row1, ray_span, radius), f);
+        }
+
+        store_texel16(pass.dst + index, color);
+    }
+}
+
+// Reduced-resolution rendering. Pixel (x, y) of the reduced image covers the pixels [x * factor, (x + 1) * factor) of
+// the full image, clipped by its border.
+struct ReducePass {
+    const ExEdit::PixelBGRA *src;
+    ExEdit::PixelBGRA *dst;
+    int w, h;
+    int reduced_w, reduced_h;
+    int factor;
+};
+
+void
+render_reduced_rows(const ReducePass &pass, int row_begin, int row_end) {
+    for (int y = row_begin; y < row_end; y++) {
+        const int y0 = y * pass.factor;
+        const int y1 = std::min(y0 + pass.factor, pass.h);
+        for (int x = 0; x < pass.reduced_w; x++) {
+            const int x0 = x * pass.factor;
+            const int x1 = std::min(x0 + pass.factor, pass.w);
+
+            __m128 sum = _mm_setzero_ps();
+            for (int sy = y0; sy < y1; sy++) {
+                const ExEdit::PixelBGRA *row = pass.src + static_cast<size_t>(sy) * pass.w;
+                for (int sx = x0; sx < x1; sx++)
+                    sum = _mm_add_ps(sum, premultiply(_mm_mul_ps(unpack_texel(load_u32(row + sx)),
+                                                                 _mm_set1_ps(INV_255))));
+            }
+
+            sum = _mm_mul_ps(sum, _mm_set1_ps(1.0f / static_cast<float>((x1 - x0) * (y1 - y0))));
+            store_texel(pass.dst + static_cast<size_t>(y) * pass.reduced_w + x, unpremultiply(sum));
+        }
+    }
+}
+
+// Bilinear interpolation of the premultiplied reduced image. pass.src is the reduced image and pass.dst the full one.
+void
+render_enlarged_rows(const ReducePass &pass, bool mix_orig_img, int row_begin, int row_end) {
+    const float inv_factor = 1.0f / static_cast<float>(pass.factor);
+    for (int y = row_begin; y < row_end; y++) {
+        for (int x = 0; x < pass.w; x++) {
+            __m128 color = _mm_setzero_ps();
+            Footprint fp;
+            if (locate_texels(pass.reduced_w, pass.reduced_h, (static_cast<float>(x) + 0.5f) * inv_factor,
+                              (static_cast<float>(y) + 0.5f) * inv_factor, fp)) {
+                auto load = [&pass](size_t index) {
+                    return premultiply(_mm_mul_ps(unpack_texel(load_u32(pass.src + index)), _mm_set1_ps(INV_255)));
+                };
+                __m128 top = lerp(load(fp.i00), load(fp.i10), fp.tx);
+                __m128 bottom = lerp(load(fp.i01), load(fp.i11), fp.tx);
+                color = unpremultiply(lerp(top, bottom, fp.ty));
+            }
+
+            ExEdit::PixelBGRA *p = pass.dst + static_cast<size_t>(y) * pass.w + x;
+            if (mix_orig_img)
+                color = blend(color, _mm_mul_ps(unpack_texel(load_u32(p)), _mm_set1_ps(INV_255)));
+
+            store_texel(p, color);
+        }
+    }
+}
+}  // namespace
+
+CpuRenderer::CpuRenderer() : has_avx2(::IsProcessorFeaturePresent(PF_AVX2_INSTRUCTIONS_AVAILABLE) != FALSE) {}
+
+CpuRenderer::~CpuRenderer() = default;
+
+void
+CpuRenderer::render(Image &img, const SegmentData<Steps> &steps_data, const SegmentData<int> &samp_data,
+                    bool mix_orig_img, AccumMode accum_mode, bool use_prefilter, bool use_jitter) {
+    if (img.size.get_x() <= 0 || img.size.get_y() <= 0 || !img.data)
+        return;
+
+    src.assign(img.data, img.data + static_cast<size_t>(img.size.get_x()) * img.size.get_y());
+
+    if (accum_mode == AccumMode::Doubling) {
+        render_doubling(img, steps_data, samp_data, mix_orig_img);
+    } else if (accum_mode == AccumMode::Sliding) {
+        render_sliding(img, steps_data, samp_data, mix_orig_img);
+    } else {
+        SegmentData<Image> sources;
+        if (use_prefilter && accum_mode == AccumMode::Standard)
+            sources = prefilter(Image{img.size, img.center, src.data()}, steps_data, samp_data);
+
+        render_standard(img, steps_data, samp_data, mix_orig_img, accum_mode, use_jitter, sources);
+    }
+}
+
+SegmentData<Image>
+CpuRenderer::prefilter(const Image &img, const SegmentData<Steps> &steps_data, const SegmentData<int> &samp_data) {
+    const int w = img.size.get_x();
+    const int h = img.size.get_y();
+    const Vec2<float> size = static_cast<Vec2<float>>(img.size);
+    const Vec2<float> pivot = img.center + size * 0.5f;
+    const bool has_seg2 = steps_data.seg2 && samp_data.seg2 && *samp_data.seg2 != 0;
+
+    std::array<bool, 2> needs_prefilter = {
+            calc_max_step_length(*steps_data.seg1, *samp_data.seg1, make_offset_map(*steps_data.offset), size, pivot)
+                    > 1.0f,
+            has_seg2 && calc_max_step_length(*steps_data.seg2, *samp_data.seg2,
+                                             make_seg2_start_map(steps_data, samp_data), size, pivot) > 1.0f};
+
+    SegmentData<Image> sources;
+    if (!needs_prefilter[0] && !needs_prefilter[1])
+        return sources;
+
+    sources.seg1 = img;
+    if (has_seg2)
+        sources.seg2 = img;
+
+    const int task_count = (h + ROWS_PER_TASK - 1) / ROWS_PER_TASK;
+    for (int c = 0; c < 2; c++) {
+        if (!needs_prefilter[c])
+            continue;
+
+        const Steps &steps = c == 0 ? *steps_data.seg1 : *steps_data.seg2;
+        prefilter_buffers[c].resize(static_cast<size_t>(w) * h);
+
+        PrefilterPass pass;
+        pass.src = img.data;
+        pass.dst = prefilter_buffers[c].data();
+        pass.w = w;
+        pass.h = h;
+        pass.pivot_x = pivot.get_x();
+        pass.pivot_y = pivot.get_y();
+        pass.step = make_chain_step(steps, 1);
+
+        get_thread_pool().parallel_for(task_count, [&](int task) {
+            int row_begin = task * ROWS_PER_TASK;
+            int row_end = std::min(row_begin + ROWS_PER_TASK, h);
+
+            if (has_avx2)
+                render_prefilter_rows<FetchAvx2>(pass, row_begin, row_end);
+            else
+                render_prefilter_rows<FetchSse2>(pass, row_begin, row_end);
+        });
+
+        std::optional<Image> &source = c == 0 ? sources.seg1 : sources.seg2;
+        source->data = pass.dst;
+    }
+
+    return sources;
+}
+
+void
+CpuRenderer::render_standard(Image &img, const SegmentData<Steps> &steps_data, const SegmentData<int> &samp_data,
+                             bool mix_orig_img, AccumMode accum_mode, bool use_jitter,
+                             const SegmentData<Image> &sources) {
+    const int w = img.size.get_x();
+    const int h = img.size.get_y();
+
+    Kernel k;
+    k.src = src.data();
+    k.dst = img.data;
+    k.w = w;
+    k.h = h;
+    k.pivot_x = img.center.get_x() + static_cast<float>(w) * 0.5f;
+    k.pivot_y = img.center.get_y() + static_cast<float>(h) * 0.5f;
+
+    const Steps &offset = *steps_data.offset;
+    k.off_scale = offset.scale;
+    k.off_pos_x = offset.location.get_x();
+    k.off_pos_y = offset.location.get_y();
+    k.off_cos = std::cos(offset.rz_rad);
+    k.off_sin = std::sin(offset.rz_rad);
+
+    int sample_count = 1;
+    k.chain_count = 0;
+    k.chains[k.chain_count++] = make_chain_step(*steps_data.seg1, *samp_data.seg1);
+    sample_count += *samp_data.seg1;
+
+    if (steps_data.seg2 && samp_data.seg2 && *samp_data.seg2 != 0) {
+        k.chains[k.chain_count++] = make_chain_step(*steps_data.seg2, *samp_data.seg2);
+        sample_count += *samp_data.seg2;
+    }
+
+    k.inv_sample_count = 1.0f / static_cast<float>(sample_count);
+    k.mix_orig_img = mix_orig_img;
+    k.chain_srcs[0] = sources.seg1 ? sources.seg1->data : k.src;
+    k.chain_srcs[1] = sources.seg2 ? sources.seg2->data : k.src;
+    k.is_adaptive = accum_mode == AccumMode::Adaptive;
+    k.is_reconstruct = accum_mode == AccumMode::Reconstruct;
+    k.has_jitter = use_jitter;
+    if (k.is_reconstruct) {
+        k.velocity_maps = make_velocity_maps(steps_data, samp_data);
+        k.samp_data = samp_data;
+    }
+    if (k.is_adaptive) {
+        Vec2<float> pivot(k.pivot_x, k.pivot_y);
+        SegmentData<AdaptiveChain> adaptive_plan =
+                make_adaptive_plan(steps_data, samp_data, static_cast<Vec2<float>>(img.size), pivot);
+        k.adaptive[0] = *adaptive_plan.seg1;
+        if (adaptive_plan.seg2)
+            k.adaptive[1] = *adaptive_plan.seg2;
+    }
+
+    // The pixels of a tile fetch from a small region of the source, so it stays in the cache.
+    const std::vector<PixelRect> tiles = make_tiles(img.size, TILE_SIZE);
+    get_thread_pool().parallel_for(static_cast<int>(tiles.size()), [&](int task) {
+        if (has_avx2)
+            render_tile<FetchAvx2>(k, tiles[task]);
+        else
+            render_tile<FetchSse2>(k, tiles[task]);
+    });
+}
+
+// Returns the buffer that holds the average of the chain. (ping or pong)
+const Texel16 *
+CpuRenderer::run_doubling_passes(const Image &img, const Affine2<float> &step_map, int samples,
+                                 std::vector<Texel16> &ping, std::vector<Texel16> &pong) {
+    const int w = img.size.get_x();
+    const int h = img.size.get_y();
+    const size_t pixel_count = static_cast<size_t>(w) * h;
+    ping.resize(pixel_count);
+    pong.resize(pixel_count);
+
+    DoublingPass pass;
+    pass.src = src.data();
+    pass.prev = nullptr;
+    pass.dst = ping.data();
+    pass.w = w;
+    pass.h = h;
+    pass.pivot_x = img.center.get_x() + static_cast<float>(w) * 0.5f;
+    pass.pivot_y = img.center.get_y() + static_cast<float>(h) * 0.5f;
+    pass.map = step_map;
+
+    // A single sample still needs the premultiplied copy, which is a pass with the identity map.
+    int pass_count = std::max(calc_doubling_passes(samples), 1);
+    if (samples <= 1)
+        pass.map = Affine2<float>();
+
+    const int task_count = (h + ROWS_PER_TASK - 1) / ROWS_PER_TASK;
+    for (int m = 0; m < pass_count; m++) {
+        get_thread_pool().parallel_for(task_count, [&](int task) {
+            int row_begin = task * ROWS_PER_TASK;
+            int row_end = std::min(row_begin + ROWS_PER_TASK, h);
+
+            if (has_avx2)
+                render_doubling_rows<FetchAvx2>(pass, row_begin, row_end);
+            else
+                render_doubling_rows<FetchSse2>(pass, row_begin, row_end);
+        });
+
+        pass.prev = pass.dst;
+        pass.dst = pass.dst == ping.data() ? pong.data() : ping.data();
+        pass.map = pass.map * pass.map;
+    }
+
+    return pass.prev;
+}
+
+void
+CpuRenderer::render_doubling(Image &img, const SegmentData<Steps> &steps_data, const SegmentData<int> &samp_data,
+                             bool mix_orig_img) {
+    const Texel16 *seg1 =
+            run_doubling_passes(img, make_fixed_step_map(*steps_data.seg1), *samp_data.seg1, pass_buffers[0],
+                                pass_buffers[1]);
+    const Texel16 *seg2 = nullptr;
+
+    if (steps_data.seg2 && samp_data.seg2 && *samp_data.seg2 != 0) {
+        // The buffer of seg1 that is not the result is free again.
+        auto &spare = seg1 == pass_buffers[0].data() ? pass_buffers[1] : pass_buffers[0];
+        seg2 = run_doubling_passes(img, make_fixed_step_map(*steps_data.seg2), *samp_data.seg2, spare,
+                                   pass_buffers[2]);
+    }
+
+    composite_chains(img, steps_data, samp_data, seg1, seg2, mix_orig_img);
+}
+
+// Returns buffer, which holds the average of the chain.
+const Texel16 *
+CpuRenderer::run_sliding_window(const Image &img, const Steps &step, int samples, std::vector<Texel16> &buffer) {
+    const int w = img.size.get_x();
+    const int h = img.size.get_y();
+    buffer.resize(static_cast<size_t>(w) * h);
+
+    // The rows of the shear run along the major axis of the motion, so that |slope| <= 1.
+    const float pos_x = step.location.get_x();
+    const float pos_y = step.location.get_y();
+    const bool is_major_x = std::abs(pos_x) >= std::abs(pos_y);
+    const float pos_a = is_major_x ? pos_x : pos_y;
+    const float pos_b = is_major_x ? pos_y : pos_x;
+
+    SlidingPass pass;
+    pass.src = src.data();
+    pass.dst = buffer.data();
+    pass.len_a = is_major_x ? w : h;
+    pass.len_b = is_major_x ? h : w;
+    pass.stride_a = is_major_x ? 1 : static_cast<size_t>(w);
+    pass.stride_b = is_major_x ? static_cast<size_t>(w) : 1;
+    pass.slope = pos_a != 0.0f ? pos_b / pos_a : 0.0f;
+
+    // Box ends relative to the pixel: t = -0.5 and t = n - 0.5.
+    const float end1 = 0.5f * pos_a;
+    const float end2 = -(static_cast<float>(std::max(samples, 1)) - 0.5f) * pos_a;
+    pass.box_lo = std::min(end1, end2);
+    pass.box_hi = std::max(end1, end2);
+
+    const float last_a = static_cast<float>(pass.len_a - 1);
+    const float last_b = static_cast<float>(pass.len_b - 1);
+    const float r_lo = std::min(0.0f, -pass.slope * last_a);
+    const float r_hi = last_b + std::max(0.0f, -pass.slope * last_a);
+    pass.r_min = std::floor(r_lo);
+    pass.row_count = static_cast<int>(std::floor(r_hi - pass.r_min)) + 2;
+
+    const int band_count = pass.row_count - 1;
+    const int task_count = (band_count + ROWS_PER_TASK - 1) / ROWS_PER_TASK;
+    ThreadPool &thread_pool = get_thread_pool();
+    row_scratch.resize(thread_pool.get_concurrency());
+    thread_pool.parallel_for(task_count, [&](int task) {
+        int band_begin = task * ROWS_PER_TASK;
+        render_sliding_rows(pass, row_scratch[ThreadPool::get_thread_index()].rows, band_begin,
+                            std::min(band_begin + ROWS_PER_TASK, band_count));
+    });
+
+    return buffer.data();
+}
+
+// Returns buffer, which holds the average of the chain.
+const Texel16 *
+CpuRenderer::run_polar_window(const Image &img, const Steps &step, int samples, std::vector<Texel16> &buffer) {
+    const int w = img.size.get_x();
+    const int h = img.size.get_y();
+    const size_t pixel_count = static_cast<size_t>(w) * h;
+    buffer.resize(pixel_count);
+
+    PolarPass pass;
+    pass.src = src.data();
+    pass.dst = buffer.data();
+    pass.w = w;
+    pass.h = h;
+    pass.pivot_x = img.center.get_x() + static_cast<float>(w) * 0.5f;
+    pass.pivot_y = img.center.get_y() + static_cast<float>(h) * 0.5f;
+
+    float max_radius = 0.0f;
+    for (float x : {0.0f, static_cast<float>(w)}) {
+        for (float y : {0.0f, static_cast<float>(h)})
+            max_radius = std::max(max_radius, std::hypot(x - pass.pivot_x, y - pass.pivot_y));
+    }
+
+    // A rotation is a box in angle, a zoom in log radius. Ends at t = -0.5 and t = n - 0.5.
+    const float n = static_cast<float>(std::max(samples, 1));
+    pass.is_ring = are_equal(std::log(step.scale) * n, 0.0f);
+    const float per_step = pass.is_ring ? step.rz_rad : std::log(step.scale);
+    pass.box_lo = std::min(0.5f * per_step, -(n - 0.5f) * per_step);
+    pass.box_hi = std::max(0.5f * per_step, -(n - 0.5f) * per_step);
+    pass.ray_nodes = static_cast<int>(max_radius) + 2;
+    pass.row_count = pass.is_ring ? pass.ray_nodes : calc_ring_nodes(static_cast<int>(std::ceil(max_radius)));
+
+    // Counting sort of the pixels by band. The band of each pixel is kept for the scatter.
+    const int band_count = (pass.is_ring ? pass.row_count - 1 + ROWS_PER_TASK - 1 : pass.row_count + ROWS_PER_TASK - 1)
+                           / ROWS_PER_TASK;
+    polar_pixels.resize(pixel_count);
+    polar_pixel_bands.resize(pixel_count);
+    polar_bands.assign(static_cast<size_t>(band_count) + 1, 0u);
+    polar_ranges.resize(static_cast<size_t>(band_count));
+    for (size_t i = 0; i < pixel_count; i++) {
+        float radius, angle;
+        to_polar(pass, static_cast<uint32_t>(i), radius, angle);
+        uint32_t band = static_cast<uint32_t>(calc_polar_row(pass, radius, angle) / ROWS_PER_TASK);
+        polar_pixel_bands[i] = band;
+
+        PolarRange &range = polar_ranges[band];
+        if (polar_bands[band + 1]++ == 0) {
+            range = PolarRange{radius, radius, angle, 0.0f, 0.0f};
+        } else {
+            float d = unwrap_angle(angle, range.ref_angle);
+            range.radius_lo = std::min(range.radius_lo, radius);
+            range.radius_hi = std::max(range.radius_hi, radius);
+            range.angle_lo = std::min(range.angle_lo, d);
+            range.angle_hi = std::max(range.angle_hi, d);
+        }
+    }
+
+    for (int band = 0; band < band_count; band++)
+        polar_bands[band + 1] += polar_bands[band];
+
+    polar_cursors.assign(polar_bands.begin(), polar_bands.end() - 1);
+    for (size_t i = 0; i < pixel_count; i++)
+        polar_pixels[polar_cursors[polar_pixel_bands[i]]++] = static_cast<uint32_t>(i);
+
+    pass.pixels = polar_pixels.data();
+    pass.band_offsets = polar_bands.data();
+    pass.band_ranges = polar_ranges.data();
+    ThreadPool &thread_pool = get_thread_pool();
+    row_scratch.resize(thread_pool.get_concurrency());
+    thread_pool.parallel_for(band_count, [&](int band) {
+        RowScratch &scratch = row_scratch[ThreadPool::get_thread_index()];
+        if (has_avx2)
+            render_polar_band<FetchAvx2>(pass, scratch.rows, scratch.offsets, band);
+        else
+            render_polar_band<FetchSse2>(pass, scratch.rows, scratch.offsets, band);
+    });
+
+    return buffer.data();
+}
+
+void
+CpuRenderer::render_sliding(Image &img, const SegmentData<Steps> &steps_data, const SegmentData<int> &samp_data,
+                            bool mix_orig_img) {
+    // Each chain is a translation or a polar chain. (is_sliding_plan())
+    auto run_window = [&](const Steps &step, int samples, std::vector<Texel16> &buffer) {
+        if (is_translation_chain(step, samples))
+            return run_sliding_window(img, step, samples, buffer);
+
+        return run_polar_window(img, step, samples, buffer);
+    };
+
+    const Texel16 *seg1 = run_window(*steps_data.seg1, *samp_data.seg1, pass_buffers[0]);
+    const Texel16 *seg2 = nullptr;
+    if (steps_data.seg2 && samp_data.seg2 && *samp_data.seg2 != 0)
+        seg2 = run_window(*steps_data.seg2, *samp_data.seg2, pass_buffers[1]);
+
+    composite_chains(img, steps_data, samp_data, seg1, seg2, mix_orig_img);
+}
+
+void
+CpuRenderer::composite_chains(Image &img, const SegmentData<Steps> &steps_data, const SegmentData<int> &samp_data,
+                              const Texel16 *seg1_average, const Texel16 *seg2_average, bool mix_orig_img) {
+    const int w = img.size.get_x();
+    const int h = img.size.get_y();
+    const Steps &seg1 = *steps_data.seg1;
+    const int seg1_samples = *samp_data.seg1;
+
+    CompositePass pass;
+    pass.src = src.data();
+    pass.seg1 = seg1_average;
+    pass.seg2 = seg2_average;
+    pass.dst = img.data;
+    pass.w = w;
+    pass.h = h;
+    pass.pivot_x = img.center.get_x() + static_cast<float>(w) * 0.5f;
+    pass.pivot_y = img.center.get_y() + static_cast<float>(h) * 0.5f;
+    pass.offset_map = make_offset_map(*steps_data.offset);
+    pass.seg1_map = make_fixed_step_map(seg1);
+    pass.seg1_samples = static_cast<float>(seg1_samples);
+    pass.seg2_samples = 0.0f;
+
+    int sample_count = 1 + seg1_samples;
+
+    if (seg2_average) {
+        const int seg2_samples = *samp_data.seg2;
+        pass.seg2_map = make_fixed_step_map(*steps_data.seg2) * make_chain_end_map(seg1, seg1_samples);
+        pass.seg2_samples = static_cast<float>(seg2_samples);
+        sample_count += seg2_samples;
+    }
+
+    pass.inv_sample_count = 1.0f / static_cast<float>(sample_count);
+    pass.mix_orig_img = mix_orig_img;
+
+    const int task_count = (h + ROWS_PER_TASK - 1) / ROWS_PER_TASK;
+    get_thread_pool().parallel_for(task_count, [&](int task) {
+        int row_begin = task * ROWS_PER_TASK;
+        int row_end = std::min(row_begin + ROWS_PER_TASK, h);
+
+        if (has_avx2)
+            render_composite_rows<FetchAvx2>(pass, row_begin, row_end);
+        else
+            render_composite_rows<FetchSse2>(pass, row_begin, row_end);
+    });
+}
+
+Image
+CpuRenderer::downsample(const Image &img, int factor) {
+    const int w = img.size.get_x();
+    const int h = img.size.get_y();
+
+    ReducePass pass;
+    pass.src = img.data;
+    pass.w = w;
+    pass.h = h;
+    pass.factor = std::max(factor, 1);
+    pass.reduced_w = (w + pass.factor - 1) / pass.factor;
+    pass.reduced_h = (h + pass.factor - 1) / pass.factor;
+    reduced_buffer.resize(static_cast<size_t>(pass.reduced_w) * pass.reduced_h);
+    pass.dst = reduced_buffer.data();
+
+    const int task_count = (pass.reduced_h + ROWS_PER_TASK - 1) / ROWS_PER_TASK;
+    get_thread_pool().parallel_for(task_count, [&](int task) {
+        int row_begin = task * ROWS_PER_TASK;
+        render_reduced_rows(pass, row_begin, std::min(row_begin + ROWS_PER_TASK, pass.reduced_h));
+    });
+
+    // The pivot, img.center + size / 2 in pixels, is scaled with the image.
+    Vec2<float> reduced_size(static_cast<float>(pass.reduced_w), static_cast<float>(pass.reduced_h));
+    Vec2<float> pivot = img.center + static_cast<Vec2<float>>(img.size) * 0.5f;
+    return Image{Vec2<int>(pass.reduced_w, pass.reduced_h),
+                 pivot * (1.0f / static_cast<float>(pass.factor)) - reduced_size * 0.5f, pass.dst};
+}
+
+void
+CpuRenderer::upsample(const Image &reduced, int factor, Image &img, bool mix_orig_img) {
+    const int w = img.size.get_x();
+    const int h = img.size.get_y();
+    if (w <= 0 || h <= 0 || reduced.size.get_x() <= 0 || reduced.size.get_y() <= 0)
+        return;
+
+    ReducePass pass;
+    pass.src = reduced.data;
+    pass.dst = img.data;
+    pass.w = w;
+    pass.h = h;
+    pass.reduced_w = reduced.size.get_x();
+    pass.reduced_h = reduced.size.get_y();
+    pass.factor = std::max(factor, 1);
+
+    const int task_count = (h + ROWS_PER_TASK - 1) / ROWS_PER_TASK;
+    get_thread_pool().parallel_for(task_count, [&](int task) {
+        int row_begin = task * ROWS_PER_TASK;
+        render_enlarged_rows(pass, mix_orig_img, row_begin, std::min(row_begin + ROWS_PER_TASK, h));
+    });
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "affine_2d.hpp"
+#include "structs.hpp"
+#include "vector_2d.hpp"
+
+// Premultiplied texel of the intermediate passes.
+// 16 bits per channel keeps the accumulated tails smooth at half the size of float.
+struct Texel16 {
+    uint16_t b, g, r, a;
+};
+
+struct RowNode;  // Row of the sliding window. Defined in cpu_renderer.cpp.
+struct PolarRange;  // Pixels of a band of polar rows. Defined in cpu_renderer.cpp.
+
+// Native implementation of shaders/MotionBlur_K.frag.
+// It consumes the same plan as the GLSL path (offset step, seg1/seg2 sample chains, premultiplied accumulation and the
+// blend composite) and writes the result back into the image buffer.
+// The output matches the GPU path within 2/255 per channel. The difference comes from the reduced-precision
+// interpolation weights of hardware bilinear filtering and from 8-bit rounding, and is largest on hard edges.
+class CpuRenderer {
+public:
+    CpuRenderer();
+    ~CpuRenderer();
+
+    CpuRenderer(const CpuRenderer &) = delete;
+    CpuRenderer &operator=(const CpuRenderer &) = delete;
+
+    void render(Image &img, const SegmentData<Steps> &steps_data, const SegmentData<int> &samp_data,
+                bool mix_orig_img, AccumMode accum_mode, bool use_prefilter, bool use_jitter);
+
+    // Directional box prefilter of the source for the standard accumulation.
+    // When the sample limit clamps the samples, a step moves a sample by more than a pixel, and the samples show up as
+    // separate copies. Each chain then samples its own copy of the source, averaged at every pixel v along the step
+    // d(v) = (M - I) v - M pos of a chain starting there: P(v) = mean of I(v - t d(v)) over t in [0, 1).
+    // So the n samples cover the whole path instead of n points of it.
+    // d(v) is exact for pure translations and for pure rotation/zoom around the pivot. Otherwise the chain turns pos
+    // on later steps, which is ignored.
+    // Returns the sources of seg1 and seg2, which stay valid until the next call. A chain that steps at most
+    // a pixel anywhere samples img itself. Both are empty if no chain needs the prefilter.
+    SegmentData<Image> prefilter(const Image &img, const SegmentData<Steps> &steps_data,
+                                 const SegmentData<int> &samp_data);
+
+    // Reduced-resolution rendering.
+    // downsample() returns img reduced by factor with box averages of the premultiplied pixels. The pivot stays at the
+    // same place of the object, so the plan only needs scale_plan(). It stays valid until the next call.
+    // upsample() interpolates the premultiplied reduced image back to the size of img, and blends it with img itself
+    // when mix_orig_img is set, so the original keeps its full resolution.
+    Image downsample(const Image &img, int factor);
+    void upsample(const Image &reduced, int factor, Image &img, bool mix_orig_img);
+
+private:
+    std::vector<ExEdit::PixelBGRA> src;  // Copy of the input. The output is written in place.
+    std::vector<Texel16> pass_buffers[3];
+    std::vector<ExEdit::PixelBGRA> prefilter_buffers[2];
+    std::vector<uint32_t> polar_pixels;       // Pixel indices sorted by the band of polar rows they need.
+    std::vector<uint32_t> polar_bands;        // Start of each band in polar_pixels.
+    std::vector<uint32_t> polar_pixel_bands;  // Band of each pixel.
+    std::vector<uint32_t> polar_cursors;
+    std::vector<PolarRange> polar_ranges;     // Radius and angle range of each band, to build only what it needs.
+    std::vector<ExEdit::PixelBGRA> reduced_buffer;
+    bool has_avx2;
+
+    // Scratch of the sliding window tasks, one per thread of the pool. (ThreadPool::get_thread_index())
+    struct RowScratch {
+        std::vector<RowNode> rows;
+        std::vector<size_t> offsets;  // Start of each row in rows, for the polar rows of varying length.
+    };
+    std::vector<RowScratch> row_scratch;
+
+    void render_standard(Image &img, const SegmentData<Steps> &steps_data, const SegmentData<int> &samp_data,
+                         bool mix_orig_img, AccumMode accum_mode, bool use_jitter,
+                         const SegmentData<Image> &sources);
+    void render_doubling(Image &img, const SegmentData<Steps> &steps_data, const SegmentData<int> &samp_data,
+                         bool mix_orig_img);
+    const Texel16 *run_doubling_passes(const Image &img, const Affine2<float> &step_map, int samples,
+                                       std::vector<Texel16> &ping, std::vector<Texel16> &pong);
+    void render_sliding(Image &img, const SegmentData<Steps> &steps_data, const SegmentData<int> &samp_data,
+                        bool mix_orig_img);
+    const Texel16 *run_sliding_window(const Image &img, const Steps &step, int samples, std::vector<Texel16> &buffer);
+    const Texel16 *run_polar_window(const Image &img, const Steps &step, int samples, std::vector<Texel16> &buffer);
+
+    // Composite of the chain averages of the doubling and the sliding window: the offset sample plus n times the
+    // average of each chain.
+    void composite_chains(Image &img, const SegmentData<Steps> &steps_data, const SegmentData<int> &samp_data,
+                          const Texel16 *seg1_average, const Texel16 *seg2_average, bool mix_orig_img);
+};
@@ -0,0 +1,297 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// Open addressing hash index with 64-bit keys.
+// Linear probing over one contiguous slot array, and backward shift deletion, so there are no tombstones.
+template <typename V>
+class FlatIndex {
+public:
+    static constexpr uint64_t EMPTY_KEY = ~0ull;  // Reserved. Never used as a key.
+
+    FlatIndex() : count(0), mask(0) {}
+
+    size_t size() const { return count; }
+
+    const V *find(uint64_t key) const {
+        if (count == 0)
+            return nullptr;
+
+        for (size_t i = home(key);; i = (i + 1) & mask) {
+            if (slots[i].key == key)
+                return &slots[i].value;
+            if (slots[i].key == EMPTY_KEY)
+                return nullptr;
+        }
+    }
+
+    V *find(uint64_t key) { return const_cast<V *>(std::as_const(*this).find(key)); }
+
+    // Insert a default value if the key does not exist.
+    V &operator[](uint64_t key) {
+        if ((count + 1) * 2 > slots.size())
+            grow();
+
+        size_t i = home(key);
+        for (; slots[i].key != EMPTY_KEY; i = (i + 1) & mask) {
+            if (slots[i].key == key)
+                return slots[i].value;
+        }
+
+        slots[i].key = key;
+        slots[i].value = V();
+        count++;
+        return slots[i].value;
+    }
+
+    bool erase(uint64_t key) {
+        if (count == 0)
+            return false;
+
+        size_t i = home(key);
+        for (; slots[i].key != key; i = (i + 1) & mask) {
+            if (slots[i].key == EMPTY_KEY)
+                return false;
+        }
+
+        // Pull back the following entries of the cluster that may live in the hole.
+        for (size_t j = (i + 1) & mask; slots[j].key != EMPTY_KEY; j = (j + 1) & mask) {
+            size_t distance_from_home = (j - home(slots[j].key)) & mask;
+            size_t distance_from_hole = (j - i) & mask;
+            if (distance_from_home >= distance_from_hole) {
+                slots[i] = std::move(slots[j]);
+                i = j;
+            }
+        }
+
+        slots[i].key = EMPTY_KEY;
+        slots[i].value = V();
+        count--;
+        return true;
+    }
+
+    // func(key, value)
+    template <typename F>
+    void for_each(F &&func) const {
+        for (const auto &slot : slots) {
+            if (slot.key != EMPTY_KEY)
+                func(slot.key, slot.value);
+        }
+    }
+
+    void clear() {
+        slots.clear();
+        count = 0;
+        mask = 0;
+    }
+
+private:
+    struct Slot {
+        uint64_t key = EMPTY_KEY;
+        V value = V();
+    };
+
+    std::vector<Slot> slots;
+    size_t count;
+    size_t mask;
+
+    // Finalizer of MurmurHash3. Neighbouring keys differ only in the low bits, so they must be mixed.
+    size_t home(uint64_t key) const {
+        key ^= key >> 33;
+        key *= 0xff51afd7ed558ccdull;
+        key ^= key >> 33;
+        return static_cast<size_t>(key) & mask;
+    }
+
+    void grow() {
+        std::vector<Slot> old_slots = std::move(slots);
+        slots.clear();
+        slots.resize(old_slots.empty() ? 16 : old_slots.size() * 2);
+        mask = slots.size() - 1;
+
+        for (auto &slot : old_slots) {
+            if (slot.key == EMPTY_KEY)
+                continue;
+
+            size_t i = home(slot.key);
+            while (slots[i].key != EMPTY_KEY) i = (i + 1) & mask;
+            slots[i] = std::move(slot);
+        }
+    }
+};
+
+// Index of storage blocks. The key of a block is (key1, block_id) packed into 64 bits.
+// key1 may use the lower 44 bits and block_id the lower 20 bits.
+// Secondary indices map each key1 to its block ids, and each group (key1 & group_mask) to its key1s. So has_key1 and
+// erasing by a mask that contains group_mask only touch the data of that group.
+// Every entry of a secondary list remembers its position in the list, so it is removed by swapping with the last one
+// in constant time.
+template <typename V>
+class BlockIndex {
+public:
+    static constexpr uint32_t BLOCK_ID_BITS = 20u;
+    static constexpr uint32_t MAX_BLOCK_ID = (1u << BLOCK_ID_BITS) - 2u;  // All ones is EMPTY_KEY.
+
+    explicit BlockIndex(uint64_t group_mask = 0u) : group_mask(group_mask) {}
+
+    size_t size() const { return blocks.size(); }
+
+    const V *find(uint64_t key1, uint32_t block_id) const {
+        const BlockEntry *entry = blocks.find(make_key(key1, block_id));
+        return entry ? &entry->value : nullptr;
+    }
+
+    V *find(uint64_t key1, uint32_t block_id) { return const_cast<V *>(std::as_const(*this).find(key1, block_id)); }
+
+    bool has_key1(uint64_t key1) const { return key1_blocks.find(key1) != nullptr; }
+
+    // Returns false if block_id is out of range.
+    bool insert(uint64_t key1, uint32_t block_id, V value) {
+        if (block_id > MAX_BLOCK_ID)
+            return false;
+
+        BlockEntry *entry = blocks.find(make_key(key1, block_id));
+        if (entry) {
+            entry->value = std::move(value);
+            return true;
+        }
+
+        Key1Entry &key1_entry = key1_blocks[key1];
+        if (key1_entry.block_ids.empty()) {
+            auto &keys1 = group_keys[key1 & group_mask];
+            key1_entry.pos = static_cast<uint32_t>(keys1.size());
+            keys1.push_back(key1);
+        }
+
+        blocks[make_key(key1, block_id)] =
+                BlockEntry{std::move(value), static_cast<uint32_t>(key1_entry.block_ids.size())};
+        key1_entry.block_ids.push_back(block_id);
+        return true;
+    }
+
+    // release(value) is called if the block exists.
+    template <typename F>
+    bool erase(uint64_t key1, uint32_t block_id, F &&release) {
+        const BlockEntry *entry = blocks.find(make_key(key1, block_id));
+        if (!entry)
+            return false;
+
+        release(entry->value);
+        uint32_t pos = entry->pos;
+        blocks.erase(make_key(key1, block_id));
+
+        auto &block_ids = key1_blocks.find(key1)->block_ids;
+        uint32_t last_id = block_ids.back();
+        block_ids[pos] = last_id;
+        block_ids.pop_back();
+        if (last_id != block_id)
+            blocks.find(make_key(key1, last_id))->pos = pos;
+
+        if (block_ids.empty())
+            erase_key1(key1);
+
+        return true;
+    }
+
+    // Erase all blocks whose key1 satisfies (key1 & mask) == match_bits. release(value) is called for each block.
+    // Returns the number of erased blocks. A mask of exactly the group bits drops the whole group at once, and a mask
+    // without the group bits falls back to a full scan.
+    template <typename F>
+    size_t erase_key1_mask(uint64_t match_bits, uint64_t mask, F &&release) {
+        size_t erased = 0u;
+        auto erase_blocks = [&](uint64_t key1) {
+            for (uint32_t block_id : key1_blocks.find(key1)->block_ids) {
+                release(blocks.find(make_key(key1, block_id))->value);
+                blocks.erase(make_key(key1, block_id));
+                erased++;
+            }
+        };
+
+        if (mask == group_mask) {
+            uint64_t group = match_bits & group_mask;
+            const auto *keys1 = group_keys.find(group);
+            if (!keys1)
+                return 0u;
+
+            for (uint64_t key1 : *keys1) {
+                erase_blocks(key1);
+                key1_blocks.erase(key1);
+            }
+
+            group_keys.erase(group);
+            return erased;
+        }
+
+        std::vector<uint64_t> keys1_to_erase;
+        if ((mask & group_mask) == group_mask) {
+            const auto *keys1 = group_keys.find(match_bits & group_mask);
+            if (!keys1)
+                return 0u;
+
+            for (uint64_t key1 : *keys1) {
+                if ((key1 & mask) == match_bits)
+                    keys1_to_erase.push_back(key1);
+            }
+        } else {
+            key1_blocks.for_each([&](uint64_t key1, const Key1Entry &) {
+                if ((key1 & mask) == match_bits)
+                    keys1_to_erase.push_back(key1);
+            });
+        }
+
+        for (uint64_t key1 : keys1_to_erase) {
+            erase_blocks(key1);
+            erase_key1(key1);
+        }
+
+        return erased;
+    }
+
+    template <typename F>
+    void clear(F &&release) {
+        blocks.for_each([&](uint64_t, const BlockEntry &entry) { release(entry.value); });
+        blocks.clear();
+        key1_blocks.clear();
+        group_keys.clear();
+    }
+
+private:
+    struct BlockEntry {
+        V value = V();
+        uint32_t pos = 0u;  // Index in the block ids of its key1.
+    };
+
+    struct Key1Entry {
+        std::vector<uint32_t> block_ids;
+        uint32_t pos = 0u;  // Index in the key1s of its group.
+    };
+
+    uint64_t group_mask;
+    FlatIndex<BlockEntry> blocks;
+    FlatIndex<Key1Entry> key1_blocks;             // key1 -> block ids
+    FlatIndex<std::vector<uint64_t>> group_keys;  // key1 & group_mask -> key1s
+
+    void erase_key1(uint64_t key1) {
+        uint32_t pos = key1_blocks.find(key1)->pos;
+        key1_blocks.erase(key1);
+
+        uint64_t group = key1 & group_mask;
+        auto &keys1 = *group_keys.find(group);
+        uint64_t last_key1 = keys1.back();
+        keys1[pos] = last_key1;
+        keys1.pop_back();
+        if (last_key1 != key1)
+            key1_blocks.find(last_key1)->pos = pos;
+
+        if (keys1.empty())
+            group_keys.erase(group);
+    }
+
+    static uint64_t make_key(uint64_t key1, uint32_t block_id) {
+        return (key1 << BLOCK_ID_BITS) | static_cast<uint64_t>(block_id);
+    }
+};
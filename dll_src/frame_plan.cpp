@@ -0,0 +1,44 @@
+#include "frame_plan.hpp"
+
+// Uniformly accelerated linear motion
+std::array<Transform, 2>
+calc_neg_frames(const std::array<Transform, 3> &tf_array) {
+    Transform d1 = tf_array[1] - tf_array[0];
+    Transform d2 = tf_array[2] - tf_array[1];
+    Transform tf_neg_1f = tf_array[0] - d1 * 2.0f + d2;
+    return {tf_neg_1f, tf_neg_1f - d1 * 3.0f + d2 * 2.0f};
+}
+
+const FramePlan &
+FramePlanner::get_plan(const ObjectUtils &obj_utils, bool is_start, bool has_prev_2f) {
+    uint64_t key = make_plan_key(obj_utils, is_start, has_prev_2f);
+    if (key == plan_key && obj_utils.get_obj_index() != 0)
+        return plan;
+
+    plan.is_start = is_start;
+    if (is_start) {
+        plan.tfs = {Transform(obj_utils, 0, OffsetType::Start), Transform(obj_utils, 1, OffsetType::Start),
+                    Transform(obj_utils, 2, OffsetType::Start)};
+    } else {
+        plan.tfs = {Transform(obj_utils), Transform(obj_utils, -1),
+                    has_prev_2f ? Transform(obj_utils, -2) : Transform()};
+    }
+
+    for (auto &tf : plan.tfs) {
+        tf.set_center(Vec2<float>(0.0f, 0.0f));
+    }
+
+    plan.tfs_neg = is_start ? calc_neg_frames(plan.tfs) : std::array<Transform, 2>{};
+    plan_key = key;
+    return plan;
+}
+
+// obj_id (bits 48-63) | filter index (bits 40-47) | frame (bits 2-33, 32 bits) | has_prev_2f (bit 1) | is_start (bit 0)
+// Bits 34-39 are unused.
+uint64_t
+FramePlanner::make_plan_key(const ObjectUtils &obj_utils, bool is_start, bool has_prev_2f) {
+    return (static_cast<uint64_t>(obj_utils.get_curr_object_idx()) << 48)
+           | (static_cast<uint64_t>(obj_utils.get_curr_filter_idx() & 0xFFu) << 40)
+           | (static_cast<uint64_t>(static_cast<uint32_t>(obj_utils.get_frame_num())) << 2)
+           | (static_cast<uint64_t>(has_prev_2f) << 1) | static_cast<uint64_t>(is_start);
+}
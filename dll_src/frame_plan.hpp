@@ -0,0 +1,33 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+#include "aul_utils.hpp"
+#include "transform_utils.hpp"
+
+// Trackbar transforms of one filter in one frame, without geometry.
+// Start plans hold frames 0, 1 and 2 of the object, and the others hold the current frame, 1 and 2 frames before.
+struct FramePlan {
+    bool is_start = false;
+    std::array<Transform, 3> tfs;
+    std::array<Transform, 2> tfs_neg;  // Frames -1 and -2, extrapolated from the start frames.
+};
+
+// Calculate the transforms before frame 0.
+std::array<Transform, 2>
+calc_neg_frames(const std::array<Transform, 3> &tf_array);
+
+// Individual objects (text, etc.) call the filter once per obj_index, and only the geometry and the center differ
+// between them. The plan is built on obj_index 0 and reused by the later indices of the same filter and frame.
+// The centers of the plan are not set. Only the main thread may use it.
+class FramePlanner {
+public:
+    const FramePlan &get_plan(const ObjectUtils &obj_utils, bool is_start, bool has_prev_2f);
+
+private:
+    FramePlan plan;
+    uint64_t plan_key = ~0ull;
+
+    static uint64_t make_plan_key(const ObjectUtils &obj_utils, bool is_start, bool has_prev_2f);
+};
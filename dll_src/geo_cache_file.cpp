@@ -0,0 +1,348 @@
+#include "geo_cache_file.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <thread>
+
+GeoCacheFile::GeoCacheFile(size_t elem_size) :
+    elem_size(elem_size),
+    record_size(sizeof(RecordKey) + ((elem_size + 7u) & ~size_t(7u))),
+    mode(GeoCacheMode::Off),
+    file(INVALID_HANDLE_VALUE),
+    mapping(nullptr),
+    view(nullptr),
+    mapped_records(0u),
+    indexed_count(0u),
+    indexed_session(0u) {}
+
+GeoCacheFile::~GeoCacheFile() { close_impl(); }
+
+bool
+GeoCacheFile::open(const std::filesystem::path &path, GeoCacheMode new_mode) {
+    std::unique_lock<std::shared_mutex> lock(mutex);
+
+    // A failed attempt is remembered as well, so that a missing file is not opened on every frame.
+    if (path == curr_path && new_mode == mode)
+        return false;
+
+    close_impl();
+    curr_path = path;
+    mode = new_mode;
+    if (mode == GeoCacheMode::Off || path.empty())
+        return true;
+
+    bool is_writable = mode == GeoCacheMode::ReadWrite;
+    file = ::CreateFileW(path.wstring().c_str(), is_writable ? (GENERIC_READ | GENERIC_WRITE) : GENERIC_READ,
+                         is_writable ? FILE_SHARE_READ : (FILE_SHARE_READ | FILE_SHARE_WRITE), nullptr,
+                         is_writable ? OPEN_ALWAYS : OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        return true;
+
+    LARGE_INTEGER file_size;
+    if (!::GetFileSizeEx(file, &file_size)) {
+        close_impl();
+        return true;
+    }
+
+    size_t size = static_cast<size_t>(file_size.QuadPart);
+    size_t num_records = size >= sizeof(Header) ? (size - sizeof(Header)) / record_size : 0u;
+    if (!is_writable && size < sizeof(Header)) {
+        close_impl();
+        return true;
+    }
+
+    if (!map(is_writable ? std::max<size_t>(num_records, INITIAL_CAPACITY) : num_records)) {
+        close_impl();
+        return true;
+    }
+
+    Header *header = get_header();
+    bool is_valid = size >= sizeof(Header) && header->magic == MAGIC && header->version == VERSION &&
+                    header->elem_size == elem_size && header->record_count <= num_records;
+    if (!is_valid) {
+        if (!is_writable) {
+            close_impl();
+            return true;
+        }
+
+        // Another version or a broken file. Start over.
+        *header = {MAGIC, VERSION, static_cast<uint32_t>(elem_size), 0u, 0u, 0u};
+    }
+
+    if (is_writable) {
+        compact();
+        if (!view)
+            return true;
+    }
+
+    index_new_records();
+    return true;
+}
+
+void
+GeoCacheFile::clear() {
+    std::unique_lock<std::shared_mutex> lock(mutex);
+
+    if (!view || mode != GeoCacheMode::ReadWrite)
+        return;
+
+    // Readers rebuild their index when the session changes.
+    Header *header = get_header();
+    header->session++;
+    std::atomic_thread_fence(std::memory_order_release);
+    header->record_count = 0u;
+
+    index.clear();
+    indexed_count = 0u;
+    indexed_session = header->session;
+}
+
+// Start a new session. The kept records are moved to the front in their order, and the file is shrunk to fit them.
+void
+GeoCacheFile::compact() {
+    Header *header = get_header();
+    uint32_t session = header->session + 1u;
+    uint32_t kept = 0u;
+    for (uint32_t record = 0u; record < header->record_count; record++) {
+        const auto *key = reinterpret_cast<const RecordKey *>(get_record(record));
+        if (session - key->session > KEEP_SESSIONS)
+            continue;
+
+        // Readers of the last session may still look at the slot, so the move is a write of it.
+        if (kept != record)
+            store_record(kept, *key, get_record(record) + sizeof(RecordKey), record_size - sizeof(RecordKey));
+
+        kept++;
+    }
+
+    header->session = session;
+    std::atomic_thread_fence(std::memory_order_release);
+    header->record_count = kept;
+
+    // Shrinking fails while another process maps the file, and then the file keeps its size.
+    size_t capacity = std::max<size_t>(static_cast<size_t>(kept) * 2u, INITIAL_CAPACITY);
+    if (capacity >= mapped_records)
+        return;
+
+    unmap();
+    LARGE_INTEGER file_size;
+    file_size.QuadPart = static_cast<LONGLONG>(sizeof(Header) + capacity * record_size);
+    if (::SetFilePointerEx(file, file_size, nullptr, FILE_BEGIN))
+        ::SetEndOfFile(file);
+
+    if (!map(capacity))
+        close_impl();
+}
+
+void
+GeoCacheFile::close() {
+    std::unique_lock<std::shared_mutex> lock(mutex);
+
+    close_impl();
+    curr_path.clear();
+    mode = GeoCacheMode::Off;
+}
+
+void
+GeoCacheFile::close_impl() noexcept {
+    unmap();
+
+    if (file != INVALID_HANDLE_VALUE) {
+        ::CloseHandle(file);
+        file = INVALID_HANDLE_VALUE;
+    }
+
+    index.clear();
+    indexed_count = 0u;
+    indexed_session = 0u;
+}
+
+bool
+GeoCacheFile::map(size_t num_records) const {
+    unmap();
+
+    bool is_writable = mode == GeoCacheMode::ReadWrite;
+    uint64_t size = is_writable ? sizeof(Header) + static_cast<uint64_t>(num_records) * record_size : 0u;  // 0: all
+    mapping = ::CreateFileMappingW(file, nullptr, is_writable ? PAGE_READWRITE : PAGE_READONLY,
+                                   static_cast<DWORD>(size >> 32), static_cast<DWORD>(size & 0xFFFFFFFFu), nullptr);
+    if (mapping == nullptr)
+        return false;
+
+    view = static_cast<std::byte *>(::MapViewOfFile(mapping, is_writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, 0));
+    if (view == nullptr) {
+        unmap();
+        return false;
+    }
+
+    mapped_records = num_records;
+    return true;
+}
+
+void
+GeoCacheFile::unmap() const {
+    if (view) {
+        ::UnmapViewOfFile(view);
+        view = nullptr;
+    }
+
+    if (mapping) {
+        ::CloseHandle(mapping);
+        mapping = nullptr;
+    }
+
+    mapped_records = 0u;
+}
+
+// Index the records published since the last call. A reader maps the file again if the writer has grown it.
+void
+GeoCacheFile::index_new_records() const {
+    uint32_t record_count = get_header()->record_count;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    uint32_t session = get_header()->session;
+
+    if (session != indexed_session || record_count < indexed_count) {
+        index.clear();
+        indexed_count = 0u;
+        indexed_session = session;
+    }
+
+    if (record_count > mapped_records && mode == GeoCacheMode::ReadOnly) {
+        LARGE_INTEGER file_size;
+        if (!::GetFileSizeEx(file, &file_size))
+            return;
+
+        size_t num_records = (static_cast<size_t>(file_size.QuadPart) - sizeof(Header)) / record_size;
+        if (!map(num_records))
+            return;
+    }
+
+    record_count = std::min(record_count, static_cast<uint32_t>(mapped_records));
+    for (uint32_t record = indexed_count; record < record_count; record++) {
+        const auto *key = reinterpret_cast<const RecordKey *>(get_record(record));
+        index[make_key(key->key1, key->key2)] = record;
+    }
+
+    indexed_count = std::max(indexed_count, record_count);
+}
+
+void
+GeoCacheFile::write_bytes(uint64_t key1, uint32_t key2, uint64_t fingerprint, const void *src, size_t size) {
+    std::unique_lock<std::shared_mutex> lock(mutex);
+
+    if (!view || mode != GeoCacheMode::ReadWrite || key2 > MAX_KEY2)
+        return;
+
+    // Rewriting a key also takes it over for another object.
+    const uint32_t *existing = index.find(make_key(key1, key2));
+    uint32_t record = existing ? *existing : get_header()->record_count;
+    if (!existing && record >= mapped_records && !map(mapped_records * 2u)) {
+        close_impl();
+        return;
+    }
+
+    RecordKey key = {0u, get_header()->session, key1, fingerprint, key2, 0u};
+    store_record(record, key, src, size);
+    if (existing)
+        return;
+
+    // Readers in other processes must not see the count before the record.
+    std::atomic_thread_fence(std::memory_order_release);
+    get_header()->record_count = record + 1u;
+
+    index[make_key(key1, key2)] = record;
+    indexed_count = record + 1u;
+}
+
+// Write everything but the sequence of the record, with the sequence odd meanwhile. The element is padded with zeros.
+// A left over odd sequence of a writer that crashed is made even by the next write.
+void
+GeoCacheFile::store_record(uint32_t record, const RecordKey &key, const void *element, size_t size) {
+    constexpr size_t body = offsetof(RecordKey, session);
+    std::byte *dst = get_record(record);
+    std::atomic_ref<uint32_t> sequence(reinterpret_cast<RecordKey *>(dst)->sequence);
+    uint32_t odd = sequence.load(std::memory_order_relaxed) | 1u;
+
+    sequence.store(odd, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    std::memcpy(dst + body, reinterpret_cast<const std::byte *>(&key) + body, sizeof(RecordKey) - body);
+    std::memcpy(dst + sizeof(RecordKey), element, size);
+    std::memset(dst + sizeof(RecordKey) + size, 0, record_size - sizeof(RecordKey) - size);
+    sequence.store(odd + 1u, std::memory_order_release);
+}
+
+// Copy a record that no write overlapped. A record that keeps changing is a miss, and then element is undefined.
+bool
+GeoCacheFile::load_record(const std::byte *record, RecordKey &key, void *element, size_t size) const {
+    // The view of a reader is read-only, but loading never writes.
+    std::atomic_ref<uint32_t> sequence(const_cast<RecordKey *>(reinterpret_cast<const RecordKey *>(record))->sequence);
+    for (int attempt = 0; attempt < READ_ATTEMPTS; attempt++) {
+        uint32_t before = sequence.load(std::memory_order_acquire);
+        if (before & 1u) {
+            std::this_thread::yield();
+            continue;
+        }
+
+        std::memcpy(&key, record, sizeof(RecordKey));
+        std::memcpy(element, record + sizeof(RecordKey), size);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (sequence.load(std::memory_order_relaxed) == before)
+            return true;
+    }
+
+    return false;
+}
+
+// The record of the key, if the index is up to date with it.
+const std::byte *
+GeoCacheFile::find_record(uint64_t key1, uint32_t key2) const {
+    if (get_header()->session != indexed_session)
+        return nullptr;
+
+    const uint32_t *record = index.find(make_key(key1, key2));
+    if (!record)
+        return nullptr;
+
+    const auto *key = reinterpret_cast<const RecordKey *>(get_record(*record));
+    return key->key1 == key1 && key->key2 == key2 ? get_record(*record) : nullptr;
+}
+
+bool
+GeoCacheFile::read_bytes(uint64_t key1, uint32_t key2, uint64_t fingerprint, void *dst, size_t size) const {
+    if (key2 > MAX_KEY2)
+        return false;
+
+    // The writer may have moved another key into the record since it was found.
+    auto copy_element = [&](const std::byte *record) {
+        RecordKey key;
+        return load_record(record, key, dst, size) && key.key1 == key1 && key.key2 == key2 &&
+               key.fingerprint == fingerprint;
+    };
+
+    {
+        std::shared_lock<std::shared_mutex> lock(mutex);
+        if (!view)
+            return false;
+
+        const std::byte *record = find_record(key1, key2);
+        if (record)
+            return copy_element(record);
+
+        const Header *header = get_header();
+        if (mode != GeoCacheMode::ReadOnly ||
+            (header->record_count == indexed_count && header->session == indexed_session))
+            return false;
+    }
+
+    // The writer has published new records, or cleared the file.
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    if (!view)
+        return false;
+
+    index_new_records();
+    if (!view)
+        return false;
+
+    const std::byte *record = find_record(key1, key2);
+    return record && copy_element(record);
+}
@@ -0,0 +1,148 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <mutex>
+#include <shared_mutex>
+#include <stdexcept>
+#include <type_traits>
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+
+#include "flat_index.hpp"
+
+enum class GeoCacheMode : int {
+    Off,
+    ReadWrite,  // Only one process should write the file at a time.
+    ReadOnly    // Records appended by the writing process are picked up on a miss. A record that the writer is rewriting
+                // or moving is never read half old and half new: the read is retried, or misses if it keeps changing.
+};
+
+// Persistent geometry cache in a memory mapped file.
+// The file is a list of records (key1, key2, fingerprint, session, element) after a versioned header. Rewriting a key
+// updates its record in place, and new keys are appended. Each process indexes the records when it opens the file.
+// Each record has a sequence counter, which is odd while the record is being written. A reader copies the record and
+// keeps the copy only if the counter was even and did not change meanwhile (a seqlock).
+// The keys don't identify an object across edits of the project, so each record also holds a fingerprint of its object,
+// and a read with another fingerprint misses.
+// Every writable open is a new session. It first drops the records that have not been written in the last
+// KEEP_SESSIONS sessions, so that the keys of deleted objects don't pile up.
+class GeoCacheFile {
+public:
+    static constexpr uint32_t MAX_KEY2 = (1u << 20) - 1u;
+    static constexpr uint32_t KEEP_SESSIONS = 8u;
+
+    explicit GeoCacheFile(size_t elem_size);
+    ~GeoCacheFile();
+
+    GeoCacheFile(const GeoCacheFile &) = delete;
+    GeoCacheFile &operator=(const GeoCacheFile &) = delete;
+
+    // Returns false if the file is kept as it is, because the same path and mode were requested last time.
+    bool open(const std::filesystem::path &path, GeoCacheMode mode);
+    void close();
+    bool is_open() const;
+    GeoCacheMode get_mode() const;
+    void clear();  // Drops all records. Only the writing process can clear the file.
+
+    template <typename T>
+    void write(uint64_t key1, uint32_t key2, uint64_t fingerprint, const T &val) {
+        static_assert(std::is_trivially_copyable_v<T>, "GeoCacheFile can only store trivially copyable types.");
+        if (sizeof(T) > elem_size)
+            throw std::invalid_argument("The element is larger than the cache element size.");
+
+        write_bytes(key1, key2, fingerprint, &val, sizeof(T));
+    }
+
+    template <typename T>
+    bool read(uint64_t key1, uint32_t key2, uint64_t fingerprint, T &val) const {
+        static_assert(std::is_trivially_copyable_v<T>, "GeoCacheFile can only store trivially copyable types.");
+        if (sizeof(T) > elem_size)
+            return false;
+
+        return read_bytes(key1, key2, fingerprint, &val, sizeof(T));
+    }
+
+private:
+    static constexpr uint32_t MAGIC = 0x47424D4Fu;  // "OMBG"
+    static constexpr uint32_t VERSION = 3u;
+    static constexpr uint32_t INITIAL_CAPACITY = 4096u;
+
+    struct Header {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t elem_size;
+        uint32_t record_count;  // Published after the record is written.
+        uint32_t session;
+        uint32_t reserved;
+    };
+
+    static constexpr int READ_ATTEMPTS = 64;
+
+    struct RecordKey {
+        uint32_t sequence;  // Odd while the rest of the record is being written.
+        uint32_t session;   // Last session that wrote the record.
+        uint64_t key1;
+        uint64_t fingerprint;
+        uint32_t key2;
+        uint32_t reserved;
+    };
+
+    mutable std::shared_mutex mutex;
+
+    size_t elem_size;
+    size_t record_size;
+    std::filesystem::path curr_path;
+    GeoCacheMode mode;
+    HANDLE file;
+    mutable HANDLE mapping;
+    mutable std::byte *view;
+    mutable size_t mapped_records;
+    mutable uint32_t indexed_count;
+    mutable uint32_t indexed_session;  // The index is rebuilt when the writer clears or compacts the file.
+    mutable FlatIndex<uint32_t> index;  // (key1, key2) -> record number
+
+    void write_bytes(uint64_t key1, uint32_t key2, uint64_t fingerprint, const void *src, size_t size);
+    bool read_bytes(uint64_t key1, uint32_t key2, uint64_t fingerprint, void *dst, size_t size) const;
+    const std::byte *find_record(uint64_t key1, uint32_t key2) const;
+    void store_record(uint32_t record, const RecordKey &key, const void *element, size_t size);
+    bool load_record(const std::byte *record, RecordKey &key, void *element, size_t size) const;
+
+    bool map(size_t num_records) const;
+    void compact();
+    void unmap() const;
+    void index_new_records() const;
+    void close_impl() noexcept;
+    Header *get_header() const;
+    std::byte *get_record(uint32_t record) const;
+
+    static uint64_t make_key(uint64_t key1, uint32_t key2);
+};
+
+inline bool
+GeoCacheFile::is_open() const {
+    return view != nullptr;
+}
+
+inline GeoCacheMode
+GeoCacheFile::get_mode() const {
+    return mode;
+}
+
+inline GeoCacheFile::Header *
+GeoCacheFile::get_header() const {
+    return reinterpret_cast<Header *>(view);
+}
+
+inline std::byte *
+GeoCacheFile::get_record(uint32_t record) const {
+    return view + sizeof(Header) + static_cast<size_t>(record) * record_size;
+}
+
+inline uint64_t
+GeoCacheFile::make_key(uint64_t key1, uint32_t key2) {
+    return (key1 << 20) | static_cast<uint64_t>(key2);
+}
@@ -0,0 +1,274 @@
+#include "geometry_store.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+// A file mapping commits at least one page, whatever the requested size is.
+static constexpr size_t FILE_MAPPING_MIN_BYTES = 4096u;
+
+GeometryStore::GeometryStore(uint32_t block_bits, size_t elem_size, uint64_t group_mask, uint64_t settings_mask) :
+    arena(block_bits, elem_size, group_mask),
+    file_mapping(block_bits, group_mask),
+    packed(block_bits, elem_size, group_mask),
+    cache(elem_size),
+    block_bits(block_bits),
+    block_size(elem_size << block_bits),
+    group_mask(group_mask),
+    settings_mask(settings_mask),
+    budget_bytes(0u),
+    used_bytes(0u),
+    write_clock(0u) {}
+
+void
+GeometryStore::set_settings(uint64_t key1, const GeoSettings &new_settings) {
+    // The previous frame and the one before it must always be in the window.
+    GeoSettings clamped = new_settings;
+    if (clamped.window_frames != 0u)
+        clamped.window_frames = std::max(clamped.window_frames, 2u);
+
+    // Every object sets its settings on every frame, but they rarely change.
+    {
+        std::shared_lock<std::shared_mutex> lock(state_mutex);
+        const GeoSettings *found = settings.find(key1 & settings_mask);
+        if (found && *found == clamped)
+            return;
+    }
+
+    std::unique_lock<std::shared_mutex> lock(state_mutex);
+    GeoSettings &curr = settings[key1 & settings_mask];
+    if (curr == clamped)
+        return;
+
+    bool is_budget_changed = curr.budget_bytes != clamped.budget_bytes;
+    curr = clamped;
+    if (is_budget_changed)
+        update_budget();
+}
+
+size_t
+GeometryStore::get_used_bytes() const {
+    std::shared_lock<std::shared_mutex> lock(state_mutex);
+    return used_bytes;
+}
+
+std::vector<GeoEviction>
+GeometryStore::take_evictions() {
+    std::unique_lock<std::shared_mutex> lock(state_mutex);
+
+    std::vector<GeoEviction> taken;
+    taken.swap(evictions);
+    return taken;
+}
+
+void
+GeometryStore::cleanup_all_handle() {
+    arena.cleanup_all_handle();
+    file_mapping.cleanup_all_handle();
+    packed.cleanup_all_handle();
+
+    std::unique_lock<std::shared_mutex> lock(state_mutex);
+    settings.clear();
+    windows.clear();
+    groups.clear();
+    used_bytes = 0u;
+    budget_bytes = 0u;
+}
+
+void
+GeometryStore::cleanup_for_key1_mask(uint64_t match_bits, uint64_t mask) {
+    if ((mask & group_mask) != group_mask)
+        throw std::invalid_argument("The cleanup mask must contain the group mask.");
+
+    std::unique_lock<std::shared_mutex> lock(state_mutex);
+    erase_blocks(match_bits, mask);
+
+    // The filters cleaned up no longer hold the budget down. They set their settings again when they write.
+    std::vector<uint64_t> erased_keys;
+    settings.for_each([&](uint64_t key, const GeoSettings &) {
+        if ((key & mask) == (match_bits & mask))
+            erased_keys.push_back(key);
+    });
+
+    for (uint64_t key : erased_keys) {
+        settings.erase(key);
+    }
+
+    if (!erased_keys.empty())
+        update_budget();
+}
+
+bool
+GeometryStore::has_key1(uint64_t key1) const {
+    return arena.has_key1(key1) || file_mapping.has_key1(key1) || packed.has_key1(key1);
+}
+
+bool
+GeometryStore::has_key_pair(uint64_t key1, uint32_t key2) const {
+    switch (get_backend(key1)) {
+        case GeoBackend::Arena:
+            return arena.has_key_pair(key1, key2);
+        case GeoBackend::FileMapping:
+            return file_mapping.has_key_pair(key1, key2);
+        case GeoBackend::Packed:
+            return packed.has_key_pair(key1, key2);
+    }
+
+    return false;
+}
+
+GeoBackend
+GeometryStore::get_backend(uint64_t key1) const {
+    std::shared_lock<std::shared_mutex> lock(state_mutex);
+    const GeoSettings *found = settings.find(key1 & settings_mask);
+    return found ? found->backend : GeoBackend::Arena;
+}
+
+// The budget holds for all objects, so the strictest one applies whichever object is processed last.
+void
+GeometryStore::update_budget() {
+    budget_bytes = 0u;
+    settings.for_each([this](uint64_t, const GeoSettings &curr) {
+        if (curr.budget_bytes != 0u && (budget_bytes == 0u || curr.budget_bytes < budget_bytes))
+            budget_bytes = curr.budget_bytes;
+    });
+}
+
+// Estimated memory held by one block. Packed blocks report their own size.
+size_t
+GeometryStore::calc_block_cost(GeoBackend block_backend) const {
+    if (block_backend == GeoBackend::Arena)
+        return block_size;
+    else
+        return std::max(block_size, FILE_MAPPING_MIN_BYTES);
+}
+
+void
+GeometryStore::on_written(uint64_t key1, uint32_t key2, ptrdiff_t grown_bytes) {
+    std::unique_lock<std::shared_mutex> lock(state_mutex);
+
+    uint64_t group = key1 & group_mask;
+    groups[group].last_written = ++write_clock;
+    add_usage(group, grown_bytes);
+
+    const GeoSettings *key_settings = settings.find(key1 & settings_mask);
+    if (key_settings && key_settings->window_frames != 0u)
+        update_window(key1, key2, key_settings->window_frames, key_settings->spill_policy);
+
+    if (budget_bytes != 0u && used_bytes > budget_bytes)
+        enforce_budget(group);
+}
+
+// Register the block of key2, and evict blocks that no longer fit in the window.
+void
+GeometryStore::update_window(uint64_t key1, uint32_t key2, uint32_t window_frames, GeoSpill spill_policy) {
+    uint32_t block_id = key2 >> block_bits;
+    if (block_id == 0u)
+        return;
+
+    auto &block_ids = windows[key1];
+    if (std::find(block_ids.begin(), block_ids.end(), block_id) != block_ids.end())
+        return;
+
+    if (block_ids.empty())
+        groups[key1 & group_mask].window_keys.push_back(key1);
+
+    block_ids.push_back(block_id);
+
+    // Frames [key2 - window_frames + 1, key2] span at most this many blocks.
+    const size_t max_blocks = static_cast<size_t>(((window_frames - 1u) >> block_bits) + 2u);
+    while (block_ids.size() > max_blocks) {
+        auto victim = block_ids.begin();
+        if (spill_policy == GeoSpill::Farthest) {
+            auto distance = [block_id](uint32_t id) { return id > block_id ? id - block_id : block_id - id; };
+            victim = std::max_element(block_ids.begin(), block_ids.end(),
+                                      [&](uint32_t a, uint32_t b) { return distance(a) < distance(b); });
+        }
+
+        erase_block(key1, *victim);
+        block_ids.erase(victim);
+    }
+}
+
+void
+GeometryStore::erase_block(uint64_t key1, uint32_t block_id) {
+    size_t freed = packed.erase_block(key1, block_id);
+    if (arena.erase_block(key1, block_id))
+        freed += calc_block_cost(GeoBackend::Arena);
+    if (file_mapping.erase_block(key1, block_id))
+        freed += calc_block_cost(GeoBackend::FileMapping);
+
+    add_usage(key1 & group_mask, -static_cast<ptrdiff_t>(freed));
+}
+
+// Apply a change of the used bytes. Usage never goes below zero.
+void
+GeometryStore::add_usage(uint64_t group, ptrdiff_t bytes) {
+    auto *usage = groups.find(group);
+    if (bytes >= 0) {
+        if (usage)
+            usage->bytes += static_cast<size_t>(bytes);
+
+        used_bytes += static_cast<size_t>(bytes);
+    } else {
+        size_t freed = static_cast<size_t>(-bytes);
+        if (usage)
+            usage->bytes -= std::min(usage->bytes, freed);
+
+        used_bytes -= std::min(used_bytes, freed);
+    }
+}
+
+// Erase blocks, windows and usage of the keys matching the mask. The mask contains group_mask.
+void
+GeometryStore::erase_blocks(uint64_t match_bits, uint64_t mask) {
+    size_t freed = arena.cleanup_for_key1_mask(match_bits, mask) * calc_block_cost(GeoBackend::Arena) +
+                   file_mapping.cleanup_for_key1_mask(match_bits, mask) * calc_block_cost(GeoBackend::FileMapping) +
+                   packed.cleanup_for_key1_mask(match_bits, mask);
+
+    used_bytes -= std::min(used_bytes, freed);
+
+    uint64_t group = match_bits & group_mask;
+    auto *usage = groups.find(group);
+    if (!usage)
+        return;
+
+    usage->bytes -= std::min(usage->bytes, freed);
+
+    // Without any block left, the remaining windows of the group are stale too.
+    auto &window_keys = usage->window_keys;
+    bool is_group_empty = usage->bytes == 0u;
+    auto it_kept = std::remove_if(window_keys.begin(), window_keys.end(), [&](uint64_t key1) {
+        if (!is_group_empty && (key1 & mask) != match_bits)
+            return false;
+
+        windows.erase(key1);
+        return true;
+    });
+    window_keys.erase(it_kept, window_keys.end());
+
+    if (is_group_empty)
+        groups.erase(group);
+}
+
+// Evict the least recently written groups except the one being written.
+void
+GeometryStore::enforce_budget(uint64_t curr_group) {
+    while (used_bytes > budget_bytes) {
+        uint64_t victim = FlatIndex<GroupUsage>::EMPTY_KEY;
+        uint64_t oldest = UINT64_MAX;
+        groups.for_each([&](uint64_t group, const GroupUsage &usage) {
+            if (group != curr_group && usage.bytes != 0u && usage.last_written < oldest) {
+                victim = group;
+                oldest = usage.last_written;
+            }
+        });
+
+        if (victim == FlatIndex<GroupUsage>::EMPTY_KEY)
+            break;  // Only the current group is left.
+
+        size_t bytes = groups.find(victim)->bytes;
+        erase_blocks(victim, group_mask);
+        groups.erase(victim);
+        evictions.push_back({victim, bytes});
+    }
+}
@@ -0,0 +1,192 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <shared_mutex>
+#include <vector>
+
+#include "arena_memory.hpp"
+#include "flat_index.hpp"
+#include "geo_cache_file.hpp"
+#include "packed_memory.hpp"
+#include "shared_memory.hpp"
+
+enum class GeoBackend : int {
+    Arena,        // In-process slabs.
+    FileMapping,  // One file mapping object per block.
+    Packed        // In-process, column-wise compressed blocks.
+};
+
+enum class GeoSpill : int {
+    Oldest,   // Evict the block written first.
+    Farthest  // Evict the block farthest from the frame being written. Robust against seeking backwards.
+};
+
+// Settings of one filter of an object. Each filter sets its own, so objects with different settings don't override each
+// other.
+struct GeoSettings {
+    GeoBackend backend = GeoBackend::Arena;
+    uint32_t window_frames = 0u;  // 0: unlimited.
+    GeoSpill spill_policy = GeoSpill::Oldest;
+    size_t budget_bytes = 0u;  // 0: unlimited.
+
+    bool operator==(const GeoSettings &) const = default;
+};
+
+struct GeoEviction {
+    uint64_t group;  // key1 & group_mask
+    size_t bytes;
+};
+
+// Geometry storage with a selectable backend.
+// Keys sharing the settings_mask bits (a filter) share one GeoSettings. Keys without settings use the defaults.
+// Each backend keeps its own data, so objects using different backends do not disturb each other.
+// Cleanup always applies to both backends.
+// With a window, only the blocks covering the last window_frames frames are kept per key1. Block 0 (frames 0 to 2,
+// which are used for calculating the frames before the first one) is never evicted.
+// Keys sharing the group_mask bits form a group (an object). The budget is global: the smallest non-zero budget of all
+// settings. Over it, the least recently written groups are evicted as a whole until the estimated usage fits, and the
+// evictions are kept until take_evictions is called.
+// The cache file is separate from the backends. It is only accessed through read_cache, write_cache and clear_cache,
+// and cleanup does not touch it.
+class GeometryStore {
+public:
+    GeometryStore(uint32_t block_bits, size_t elem_size, uint64_t group_mask, uint64_t settings_mask);
+
+    GeometryStore(const GeometryStore &) = delete;
+    GeometryStore &operator=(const GeometryStore &) = delete;
+
+    void set_settings(uint64_t key1, const GeoSettings &new_settings);  // For all keys sharing the settings_mask bits.
+    size_t get_used_bytes() const;
+    std::vector<GeoEviction> take_evictions();
+    bool set_cache(const std::filesystem::path &path, GeoCacheMode mode);  // Returns true if the file was reopened.
+    bool is_cache_open() const;
+    void clear_cache();
+
+    void cleanup_all_handle();
+    void cleanup_for_key1_mask(uint64_t match_bits, uint64_t mask);  // mask must contain group_mask.
+    bool has_key1(uint64_t key1) const;
+    bool has_key_pair(uint64_t key1, uint32_t key2) const;
+
+    template <typename T>
+    void write(uint64_t key1, uint32_t key2, const T &val) {
+        ptrdiff_t grown_bytes = 0;
+        switch (get_backend(key1)) {
+            case GeoBackend::Arena:
+                if (arena.write(key1, key2, val))
+                    grown_bytes = static_cast<ptrdiff_t>(calc_block_cost(GeoBackend::Arena));
+                break;
+            case GeoBackend::FileMapping:
+                if (file_mapping.write(key1, key2, val))
+                    grown_bytes = static_cast<ptrdiff_t>(calc_block_cost(GeoBackend::FileMapping));
+                break;
+            case GeoBackend::Packed:
+                grown_bytes = packed.write(key1, key2, val);
+                break;
+        }
+
+        on_written(key1, key2, grown_bytes);
+    }
+
+    template <typename T>
+    bool read(uint64_t key1, uint32_t key2, T &val) const {
+        switch (get_backend(key1)) {
+            case GeoBackend::Arena:
+                return arena.read(key1, key2, val);
+            case GeoBackend::FileMapping:
+                return file_mapping.read(key1, key2, val);
+            case GeoBackend::Packed:
+                return packed.read(key1, key2, val);
+        }
+
+        return false;
+    }
+
+    // Search key2 - 1, key2 - 2, ... (at most max_distance elements) for the nearest element satisfying pred.
+    // Missing blocks are skipped as a whole.
+    template <typename T, typename Pred>
+    bool find_prev(uint64_t key1, uint32_t key2, uint32_t max_distance, Pred pred, uint32_t &found_key2,
+                   T &val) const {
+        uint32_t lower = key2 > max_distance ? key2 - max_distance : 0u;
+        for (uint32_t k = key2; k > lower;) {
+            k--;
+
+            T candidate;
+            if (!read(key1, k, candidate)) {
+                k &= ~((1u << block_bits) - 1u);  // Continue from the last element of the previous block.
+                continue;
+            }
+
+            if (pred(candidate)) {
+                found_key2 = k;
+                val = candidate;
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    // fingerprint identifies the object of key1. A record of another object is not read.
+    template <typename T>
+    void write_cache(uint64_t key1, uint32_t key2, uint64_t fingerprint, const T &val) {
+        cache.write(key1, key2, fingerprint, val);
+    }
+
+    template <typename T>
+    bool read_cache(uint64_t key1, uint32_t key2, uint64_t fingerprint, T &val) const {
+        return cache.read(key1, key2, fingerprint, val);
+    }
+
+private:
+    ArenaMemory arena;
+    SharedMemory file_mapping;
+    PackedMemory packed;
+    GeoCacheFile cache;
+    uint32_t block_bits;
+    size_t block_size;
+    uint64_t group_mask;
+    uint64_t settings_mask;
+
+    struct GroupUsage {
+        size_t bytes = 0;
+        uint64_t last_written = 0;
+        std::vector<uint64_t> window_keys;  // key1s having a window.
+    };
+
+    mutable std::shared_mutex state_mutex;  // Shared by the lookups, unique for the changes.
+    FlatIndex<GeoSettings> settings;           // key1 & settings_mask -> settings
+    FlatIndex<std::vector<uint32_t>> windows;  // key1 -> block ids in written order, except block 0.
+    size_t budget_bytes;                       // Smallest non-zero budget of the settings.
+    size_t used_bytes;
+    uint64_t write_clock;
+    FlatIndex<GroupUsage> groups;
+    std::vector<GeoEviction> evictions;
+
+    GeoBackend get_backend(uint64_t key1) const;
+    void update_budget();
+    size_t calc_block_cost(GeoBackend block_backend) const;
+    void on_written(uint64_t key1, uint32_t key2, ptrdiff_t grown_bytes);
+    void add_usage(uint64_t group, ptrdiff_t bytes);
+    void update_window(uint64_t key1, uint32_t key2, uint32_t window_frames, GeoSpill spill_policy);
+    void erase_block(uint64_t key1, uint32_t block_id);
+    void erase_blocks(uint64_t match_bits, uint64_t mask);
+    void enforce_budget(uint64_t curr_group);
+};
+
+inline bool
+GeometryStore::set_cache(const std::filesystem::path &path, GeoCacheMode mode) {
+    return cache.open(path, mode);
+}
+
+inline bool
+GeometryStore::is_cache_open() const {
+    return cache.is_open();
+}
+
+inline void
+GeometryStore::clear_cache() {
+    cache.clear();
+}
@@ -4,6 +4,42 @@
 #include <cmath>
 #include <stdexcept>
 
+// 1: Auto, 2: GPU, 3: CPU
+static RenderEngine
+to_render_engine(lua_Integer value) {
+    return static_cast<RenderEngine>(std::clamp(static_cast<int>(value), 1, 3) - 1);
+}
+
+// 1: Standard, 2: Doubling, 3: Adaptive, 4: Sliding, 5: Reconstruct
+static AccumMode
+to_accum_mode(lua_Integer value) {
+    return static_cast<AccumMode>(std::clamp(static_cast<int>(value), 1, 5) - 1);
+}
+
+// 1: Arena, 2: File Mapping, 3: Packed
+static GeoBackend
+to_geo_backend(lua_Integer value) {
+    return static_cast<GeoBackend>(std::clamp(static_cast<int>(value), 1, 3) - 1);
+}
+
+// 1: Oldest, 2: Farthest
+static GeoSpill
+to_geo_spill(lua_Integer value) {
+    return static_cast<GeoSpill>(std::clamp(static_cast<int>(value), 1, 2) - 1);
+}
+
+// 1: Off, 2: Read Write, 3: Read Only
+static GeoCacheMode
+to_geo_cache_mode(lua_Integer value) {
+    return static_cast<GeoCacheMode>(std::clamp(static_cast<int>(value), 1, 3) - 1);
+}
+
+// 1: Auto, 2: Off, 3: Half, 4: Quarter
+static Downscale
+to_downscale(lua_Integer value) {
+    return static_cast<Downscale>(std::clamp(static_cast<int>(value), 1, 4) - 1);
+}
+
 // Parameters for object motion blur
 ObjectMotionBlurParams::ObjectMotionBlurParams(lua_State *L, bool is_saving) :
     shutter_angle(lua_isnumber(L, 1) ? std::clamp(static_cast<float>(lua_tonumber(L, 1)), 0.0f, 720.0f) : 180.0f),
@@ -19,45 +55,69 @@ ObjectMotionBlurParams::ObjectMotionBlurParams(lua_State *L, bool is_saving) :
     reload_shader(lua_isboolean(L, 11) ? lua_toboolean(L, 11) : false),
     print_info(lua_isboolean(L, 12) ? lua_toboolean(L, 12) : false),
     shader_dir(lua_isstring(L, 13) ? lua_tostring(L, 13) : "\\shaders"),
-    samp_lim((preview_samp_lim != 0 && !is_saving) ? preview_samp_lim : render_samp_lim) {}
+    render_engine(lua_isnumber(L, 14) ? to_render_engine(lua_tointeger(L, 14)) : RenderEngine::Auto),
+    accum_mode(lua_isnumber(L, 15) ? to_accum_mode(lua_tointeger(L, 15)) : AccumMode::Standard),
+    geo_backend(lua_isnumber(L, 16) ? to_geo_backend(lua_tointeger(L, 16)) : GeoBackend::Arena),
+    geo_window(lua_isnumber(L, 17) ? std::max(static_cast<int>(lua_tointeger(L, 17)), 0) : 0),
+    geo_spill(lua_isnumber(L, 18) ? to_geo_spill(lua_tointeger(L, 18)) : GeoSpill::Oldest),
+    geo_budget_mb(lua_isnumber(L, 19) ? std::clamp(static_cast<int>(lua_tointeger(L, 19)), 0, 2048) : 0),
+    geo_cache(lua_isnumber(L, 20) ? to_geo_cache_mode(lua_tointeger(L, 20)) : GeoCacheMode::Off),
+    geo_backfill(lua_isnumber(L, 21) ? std::max(static_cast<int>(lua_tointeger(L, 21)), 0) : 0),
+    prefetch_frames(lua_isnumber(L, 22) ? std::clamp(static_cast<int>(lua_tointeger(L, 22)), 0, 120) : 0),
+    prefilter(lua_isboolean(L, 23) ? lua_toboolean(L, 23) : false),
+    jitter(lua_isnumber(L, 24) ? std::clamp(static_cast<int>(lua_tointeger(L, 24)), 0, 16) : 0),
+    render_downscale(lua_isnumber(L, 25) ? to_downscale(lua_tointeger(L, 25)) : Downscale::Auto),
+    preview_downscale(lua_isnumber(L, 26) ? std::clamp(static_cast<int>(lua_tointeger(L, 26)), 1, 4) : 1),
+    clear_geo_cache(lua_isboolean(L, 27) ? lua_toboolean(L, 27) : false),
+    samp_lim((preview_samp_lim != 0 && !is_saving) ? preview_samp_lim : render_samp_lim),
+    downscale((preview_downscale != 1 && !is_saving) ? to_downscale(preview_downscale) : render_downscale) {}
 
-// Enable the use of GLShaderKit in C++
-GLShaderKit::GLShaderKit(lua_State *L) : L(L) {
-    lua_getglobal(L, "require");
-    lua_pushstring(L, "GLShaderKit");
-    lua_call(L, 1, 1);
+// Result of loading GLShaderKit into a lua_State.
+struct GLShaderKitModule {
+    lua_State *state = nullptr;
+    int ref = LUA_NOREF;  // The module in the registry.
+    std::string error;
+};
+
+static GLShaderKitModule &
+get_gl_shader_kit_module() {
+    static GLShaderKitModule module;
+    return module;
 }
 
-Image
-GLShaderKit::get_image() const {
-    lua_getglobal(L, "obj");
-    lua_getfield(L, -1, "getpixeldata");
-    lua_call(L, 0, 3);
-    Image img;
-    img.size.set_x(lua_tointeger(L, -2));
-    img.size.set_y(lua_tointeger(L, -1));
-    img.data = reinterpret_cast<ExEdit::PixelBGRA *>(lua_touserdata(L, -3));
-    lua_pop(L, 3);
-    lua_getfield(L, -1, "cx");
-    img.center.set_x(static_cast<float>(lua_tonumber(L, -1)));
-    lua_pop(L, 1);
-    lua_getfield(L, -1, "cy");
-    img.center.set_y(static_cast<float>(lua_tonumber(L, -1)));
-    lua_pop(L, 2);
-    return img;
+// Enable the use of GLShaderKit in C++
+// The module is loaded once in protected mode so that a missing GLShaderKit can fall back to the CPU engine, and the
+// error is kept for the forced GPU engine.
+GLShaderKit::GLShaderKit(lua_State *L) : L(L), is_loaded(false) {
+    GLShaderKitModule &module = get_gl_shader_kit_module();
+    if (module.state != L) {
+        module = GLShaderKitModule{L, LUA_NOREF, {}};
+        lua_getglobal(L, "require");
+        lua_pushstring(L, "GLShaderKit");
+        if (lua_pcall(L, 1, 1, 0) == 0) {
+            module.ref = luaL_ref(L, LUA_REGISTRYINDEX);
+        } else {
+            const char *message = lua_tostring(L, -1);
+            module.error = message ? message : "unknown error";
+            lua_pop(L, 1);
+        }
+    }
+
+    is_loaded = module.ref != LUA_NOREF;
+    if (is_loaded)
+        lua_rawgeti(L, LUA_REGISTRYINDEX, module.ref);
 }
 
-void
-GLShaderKit::putpixeldata(void *data) const {
-    lua_getglobal(L, "obj");
-    lua_getfield(L, -1, "putpixeldata");
-    lua_pushlightuserdata(L, data);
-    lua_call(L, 1, 0);
-    lua_pop(L, 1);
+const std::string &
+GLShaderKit::getLoadError() const {
+    return get_gl_shader_kit_module().error;
 }
 
 bool
 GLShaderKit::isInitialized() const {
+    if (!is_loaded)
+        return false;
+
     lua_getfield(L, -1, "isInitialized");
     lua_call(L, 0, 1);
     bool value = lua_toboolean(L, -1);
@@ -107,66 +167,185 @@ GLShaderKit::setTexture2D(int unit, const Image &img) const {
 }
 
 void
-GLShaderKit::setFloat(std::string name, const std::vector<float> &vec) const {
+GLShaderKit::setFloat(const char *name, std::initializer_list<float> values) const {
     lua_getfield(L, -1, "setFloat");
-    lua_pushstring(L, name.c_str());
-    for (float value : vec) lua_pushnumber(L, value);
+    lua_pushstring(L, name);
+    for (float value : values) lua_pushnumber(L, value);
 
-    lua_call(L, vec.size() + 1, 0);
+    lua_call(L, static_cast<int>(values.size()) + 1, 0);
 }
 
 void
-GLShaderKit::setInt(std::string name, const std::vector<int> &vec) const {
+GLShaderKit::setInt(const char *name, std::initializer_list<int> values) const {
     lua_getfield(L, -1, "setInt");
-    lua_pushstring(L, name.c_str());
-    for (int value : vec) lua_pushinteger(L, value);
+    lua_pushstring(L, name);
+    for (int value : values) lua_pushinteger(L, value);
 
-    lua_call(L, vec.size() + 1, 0);
+    lua_call(L, static_cast<int>(values.size()) + 1, 0);
 }
 
+// The table of values is kept in the registry and reused, so that no table is created per call.
 void
-GLShaderKit::setMatrix(std::string name, std::string type, bool transpose, float angle_rad) const {
+GLShaderKit::setMatrix(const char *name, const char *type, bool transpose, const float *values, int count) const {
+    static constexpr const char *TABLE_KEY = "MotionBlur_K.matrix_values";
+
     lua_getfield(L, -1, "setMatrix");
-    lua_pushstring(L, name.c_str());
-    lua_pushstring(L, type.c_str());
+    lua_pushstring(L, name);
+    lua_pushstring(L, type);
     lua_pushboolean(L, transpose);
 
-    float cos = std::cos(angle_rad);
-    float sin = std::sin(angle_rad);
+    lua_getfield(L, LUA_REGISTRYINDEX, TABLE_KEY);
+    if (!lua_istable(L, -1)) {
+        lua_pop(L, 1);
+        lua_createtable(L, 16, 0);
+        lua_pushvalue(L, -1);
+        lua_setfield(L, LUA_REGISTRYINDEX, TABLE_KEY);
+    }
 
-    lua_newtable(L);
+    // Drop the values of a larger matrix set last time.
+    int prev_count = static_cast<int>(lua_objlen(L, -1));
+    for (int i = 0; i < count; i++) {
+        lua_pushnumber(L, values[i]);
+        lua_rawseti(L, -2, i + 1);
+    }
 
-    lua_pushnumber(L, cos);
-    lua_rawseti(L, -2, 1);
-    lua_pushnumber(L, sin);
-    lua_rawseti(L, -2, 2);
-    lua_pushnumber(L, -sin);
-    lua_rawseti(L, -2, 3);
-    lua_pushnumber(L, cos);
-    lua_rawseti(L, -2, 4);
+    for (int i = prev_count; i > count; i--) {
+        lua_pushnil(L);
+        lua_rawseti(L, -2, i);
+    }
 
     lua_call(L, 4, 0);
 }
 
 void
-GLShaderKit::draw(std::string mode, Image &img) const {
+GLShaderKit::draw(const char *mode, Image &img) const {
     lua_getfield(L, -1, "draw");
-    lua_pushstring(L, mode.c_str());
+    lua_pushstring(L, mode);
     lua_pushlightuserdata(L, img.data);
     lua_pushinteger(L, img.size.get_x());
     lua_pushinteger(L, img.size.get_y());
     lua_call(L, 4, 0);
 }
 
+// Layout of shaders/MotionBlur_K.frag. The matrices are column major.
+// params (mat4): (resolution, pivot), (offset pos, seg1 pos), (seg2 pos, region origin),
+//                (seg1 rz_rad, seg1 log_scale, seg2 rz_rad, seg2 log_scale)
+// step_mats (mat4): the offset, seg1 and seg2 matrices as mat2, (tile size, tile origin)
+// counts (ivec2): (seg1 samples, seg2 samples)
+void
+GLShaderKit::setParamsForOMB(const Vec2<float> &pivot, const SegmentData<Steps> &steps_data,
+                             const SegmentData<int> &samp_data, const PixelRect &region, const PixelRect &tile) const {
+    Vec2<float> origin(static_cast<float>(region.x0), static_cast<float>(region.y0));
+    Vec2<float> region_pivot = pivot - origin;
+    std::array<float, 16> params = {static_cast<float>(region.get_w()), static_cast<float>(region.get_h()),
+                                    region_pivot.get_x(), region_pivot.get_y()};
+    params[10] = origin.get_x();
+    params[11] = origin.get_y();
+    std::array<float, 16> step_mats = {};
+    step_mats[12] = static_cast<float>(tile.get_w());
+    step_mats[13] = static_cast<float>(tile.get_h());
+    step_mats[14] = static_cast<float>(tile.x0 - region.x0);
+    step_mats[15] = static_cast<float>(tile.y0 - region.y0);
+    auto pack_map = [&params, &step_mats](int index, const Affine2<float> &map, const Vec2<float> &pos) {
+        params[4 + index * 2 + 0] = pos.get_x();
+        params[4 + index * 2 + 1] = pos.get_y();
+        step_mats[index * 4 + 0] = map.get_a();
+        step_mats[index * 4 + 1] = map.get_c();
+        step_mats[index * 4 + 2] = map.get_b();
+        step_mats[index * 4 + 3] = map.get_d();
+    };
+
+    Affine2<float> offset_map = make_offset_map(*steps_data.offset);
+    pack_map(0, offset_map, Vec2<float>(offset_map.get_tx(), offset_map.get_ty()));
+    pack_map(1, make_step_matrix(*steps_data.seg1), steps_data.seg1->location);
+    params[12] = steps_data.seg1->rz_rad;
+    params[13] = std::log(steps_data.seg1->scale);
+    if (steps_data.seg2) {
+        pack_map(2, make_step_matrix(*steps_data.seg2), steps_data.seg2->location);
+        params[14] = steps_data.seg2->rz_rad;
+        params[15] = std::log(steps_data.seg2->scale);
+    }
+
+    setMatrix("params", "4x4", false, params.data(), static_cast<int>(params.size()));
+    setMatrix("step_mats", "4x4", false, step_mats.data(), static_cast<int>(step_mats.size()));
+    setInt("counts", {*samp_data.seg1, samp_data.seg2 ? *samp_data.seg2 : 0});
+}
+
 void
-GLShaderKit::setParamsForOMBStep(const std::string &name, const Steps &steps) const {
-    std::string pos_param = "step_pos_" + name;
-    std::string scale_param = "step_scale_" + name;
-    std::string rot_param = "step_rot_mat_" + name;
-
-    setFloat(pos_param.c_str(), {steps.location.get_x(), steps.location.get_y()});
-    setFloat(scale_param.c_str(), {steps.scale});
-    setMatrix(rot_param.c_str(), "2x2", false, steps.rz_rad);
+GLShaderKit::setParamsForOMBAdaptive(const SegmentData<AdaptiveChain> &adaptive_plan) const {
+    std::array<float, 16> adaptive = {};
+    auto pack_chain = [&adaptive](int column, const AdaptiveChain &chain) {
+        adaptive[column * 4 + 0] = chain.k_radius;
+        adaptive[column * 4 + 1] = chain.k_const;
+        adaptive[column * 4 + 2] = chain.rz_rad;
+        adaptive[column * 4 + 3] = chain.log_scale;
+    };
+
+    pack_chain(0, *adaptive_plan.seg1);
+    if (adaptive_plan.seg2)
+        pack_chain(1, *adaptive_plan.seg2);
+
+    setMatrix("adaptive", "4x4", false, adaptive.data(), static_cast<int>(adaptive.size()));
+}
+
+// Layout of reconstruct in shaders/MotionBlur_K.frag. The matrices are column major.
+// (seg1 W as mat2), (seg2 W as mat2), (seg1 W pos, seg2 W pos), (tap limit, tile size, unused, unused)
+void
+GLShaderKit::setParamsForOMBReconstruct(const SegmentData<Affine2<float>> &velocity_maps) const {
+    std::array<float, 16> reconstruct = {};
+    auto pack_map = [&reconstruct](int index, const Affine2<float> &map) {
+        reconstruct[index * 4 + 0] = map.get_a();
+        reconstruct[index * 4 + 1] = map.get_c();
+        reconstruct[index * 4 + 2] = map.get_b();
+        reconstruct[index * 4 + 3] = map.get_d();
+        reconstruct[8 + index * 2 + 0] = map.get_tx();
+        reconstruct[8 + index * 2 + 1] = map.get_ty();
+    };
+
+    pack_map(0, *velocity_maps.seg1);
+    if (velocity_maps.seg2)
+        pack_map(1, *velocity_maps.seg2);
+    reconstruct[12] = static_cast<float>(RECONSTRUCT_TAPS);
+    reconstruct[13] = static_cast<float>(RECONSTRUCT_TILE);
+
+    setMatrix("reconstruct", "4x4", false, reconstruct.data(), static_cast<int>(reconstruct.size()));
+}
+
+void
+GLShaderKit::setParamsForAffine(const std::string &name, const Affine2<float> &map) const {
+    std::string mat_param = name + "_mat";
+    std::string pos_param = name + "_pos";
+
+    setFloat(mat_param.c_str(), {map.get_a(), map.get_b(), map.get_c(), map.get_d()});
+    setFloat(pos_param.c_str(), {map.get_tx(), map.get_ty()});
+}
+
+Image
+get_image(lua_State *L) {
+    lua_getglobal(L, "obj");
+    lua_getfield(L, -1, "getpixeldata");
+    lua_call(L, 0, 3);
+    Image img;
+    img.size.set_x(lua_tointeger(L, -2));
+    img.size.set_y(lua_tointeger(L, -1));
+    img.data = reinterpret_cast<ExEdit::PixelBGRA *>(lua_touserdata(L, -3));
+    lua_pop(L, 3);
+    lua_getfield(L, -1, "cx");
+    img.center.set_x(static_cast<float>(lua_tonumber(L, -1)));
+    lua_pop(L, 1);
+    lua_getfield(L, -1, "cy");
+    img.center.set_y(static_cast<float>(lua_tonumber(L, -1)));
+    lua_pop(L, 2);
+    return img;
+}
+
+void
+put_image(void *data, lua_State *L) {
+    lua_getglobal(L, "obj");
+    lua_getfield(L, -1, "putpixeldata");
+    lua_pushlightuserdata(L, data);
+    lua_call(L, 1, 0);
+    lua_pop(L, 1);
 }
 
 void
@@ -3,14 +3,24 @@
 #include <array>
 #include <cstdint>
 #include <filesystem>
+#include <initializer_list>
 #include <string>
 #include <vector>
 
 #include <lua.hpp>
 
+#include "affine_2d.hpp"
+#include "blur_plan.hpp"
+#include "geometry_store.hpp"
 #include "structs.hpp"
 #include "vector_2d.hpp"
 
+enum class RenderEngine : int {
+    Auto,
+    GPU,
+    CPU
+};
+
 struct ObjectMotionBlurParams {
     const float shutter_angle;
     const float shutter_phase;
@@ -25,7 +35,22 @@ struct ObjectMotionBlurParams {
     const bool reload_shader;
     const bool print_info;
     const std::filesystem::path shader_dir;
+    const RenderEngine render_engine;
+    const AccumMode accum_mode;
+    const GeoBackend geo_backend;
+    const int geo_window;
+    const GeoSpill geo_spill;
+    const int geo_budget_mb;
+    const GeoCacheMode geo_cache;
+    const int geo_backfill;
+    const int prefetch_frames;
+    const bool prefilter;
+    const int jitter;  // Pixels per sample the planner aims at with jittered samples. 0: off.
+    const Downscale render_downscale;
+    const int preview_downscale;  // 1: same as render_downscale, 2: Off, 3: Half, 4: Quarter
+    const bool clear_geo_cache;
     const int samp_lim;
+    const Downscale downscale;
 
     ObjectMotionBlurParams(lua_State *L, bool is_saving);
 };
@@ -34,25 +59,37 @@ class GLShaderKit {
 public:
     explicit GLShaderKit(lua_State *L);
 
-    Image get_image() const;
-    void putpixeldata(void *data) const;
-
     bool isInitialized() const;
+    // Error message of the failed require, or empty.
+    const std::string &getLoadError() const;
     bool activate() const;
     void deactivate() const;
     void setPlaneVertex(int n) const;
     void setShader(const std::string &shader_path, bool force_reload) const;
     void setTexture2D(int unit, const Image &img) const;
-    void setFloat(std::string name, const std::vector<float> &vec) const;
-    void setInt(std::string name, const std::vector<int> &vec) const;
-    void setMatrix(std::string name, std::string type, bool transpose, float angle_rad) const;
-    void draw(std::string mode, Image &img) const;
+    void setFloat(const char *name, std::initializer_list<float> values) const;
+    void setInt(const char *name, std::initializer_list<int> values) const;
+    void setMatrix(const char *name, const char *type, bool transpose, const float *values, int count) const;
+    void draw(const char *mode, Image &img) const;
 
-    void setParamsForOMBStep(const std::string &name, const Steps &steps) const;  // OMBStep: Object Motion Blur Step
+    // OMB: Object Motion Blur. The whole plan is uploaded as precomposed maps in two matrices.
+    // The textures hold region of the image and the output is tile. Both and pivot are in pixels of the image.
+    void setParamsForOMB(const Vec2<float> &pivot, const SegmentData<Steps> &steps_data,
+                         const SegmentData<int> &samp_data, const PixelRect &region, const PixelRect &tile) const;
+    void setParamsForOMBAdaptive(const SegmentData<AdaptiveChain> &adaptive_plan) const;
+    void setParamsForOMBReconstruct(const SegmentData<Affine2<float>> &velocity_maps) const;
+    void setParamsForAffine(const std::string &name, const Affine2<float> &map) const;
 
 private:
     lua_State *L;
+    bool is_loaded;
 };
 
+Image
+get_image(lua_State *L);
+
+void
+put_image(void *data, lua_State *L);
+
 void
 expand_image(const std::array<int, 4> &expansion, lua_State *L);
\ No newline at end of file
@@ -1,5 +1,6 @@
 #include <algorithm>
 #include <array>
+#include <cmath>
 #include <cstdint>
 #include <filesystem>
 #include <iostream>
@@ -8,14 +9,18 @@
 #include <sstream>
 #include <stdexcept>
 #include <string>
-#include <type_traits>
-#include <variant>
+#include <unordered_set>
+#include <vector>
 #define NOMINMAX
 #include <Windows.h>
 
 #include "aul_utils.hpp"
+#include "blur_plan.hpp"
+#include "cpu_renderer.hpp"
+#include "frame_plan.hpp"
 #include "lua_func.hpp"
-#include "shared_memory.hpp"
+#include "geometry_store.hpp"
+#include "shader_cache.hpp"
 #include "structs.hpp"
 #include "transform_utils.hpp"
 #include "utils.hpp"
@@ -23,48 +28,145 @@
 static constexpr const char *WARNING_COL = "\033[38;5;208m";
 static constexpr const char *RESET_COL = "\033[0m";
 
-// The object index (obj_id) is a uint16_t, but the maximum value is probably 15000, so 14 bits (max 16383) should be
-// sufficient. I don't think there are more than 262,144 (2^18) individual objects.
-inline static constexpr uint32_t
-make_shared_mem_key(uint16_t obj_id, int32_t obj_index) {
-    uint32_t id_t = (static_cast<uint32_t>(obj_index & 0x3FFFF) << 14);
-    uint32_t id_b = static_cast<uint32_t>(obj_id & 0x3FFFu);
-    uint32_t id = id_t | id_b;
-    return id;
+// Key of the geometry store: obj_id (16 bits) | filter index (8 bits) | obj_index (20 bits).
+// The filter index keeps several motion blur filters on one object apart. The store appends a 20 bits block id, so the
+// whole key fits in 64 bits. I don't think there are more than 1,048,576 (2^20) individual objects.
+static constexpr uint32_t GEO_KEY_INDEX_BITS = 20u;
+static constexpr uint32_t GEO_KEY_FILTER_BITS = 8u;
+static constexpr uint64_t GEO_KEY_OBJECT_MASK = 0xFFFFull << (GEO_KEY_INDEX_BITS + GEO_KEY_FILTER_BITS);
+static constexpr uint64_t GEO_KEY_FILTER_MASK = GEO_KEY_OBJECT_MASK | (0xFFull << GEO_KEY_INDEX_BITS);
+
+inline static constexpr uint64_t
+make_geo_key(uint16_t obj_id, uint16_t filter_idx, int32_t obj_index) {
+    uint64_t id_t = static_cast<uint64_t>(obj_id) << (GEO_KEY_INDEX_BITS + GEO_KEY_FILTER_BITS);
+    uint64_t id_m = static_cast<uint64_t>(filter_idx & 0xFFu) << GEO_KEY_INDEX_BITS;
+    uint64_t id_b = static_cast<uint64_t>(obj_index & 0xFFFFF);
+    return id_t | id_m | id_b;
 }
 
-// Get shared memory class.
-static std::unique_ptr<SharedMemory> &
-get_shared_mem() {
-    static std::unique_ptr<SharedMemory> shared_mem = std::make_unique<SharedMemory>(3u);  // 8 elems per block.
-    return shared_mem;
+// Get geometry store class.
+static std::unique_ptr<GeometryStore> &
+get_geo_store() {
+    static std::unique_ptr<GeometryStore> geo_store =
+            std::make_unique<GeometryStore>(5u, sizeof(Geometry), GEO_KEY_OBJECT_MASK,  // 32 elems per block.
+                                            GEO_KEY_FILTER_MASK);
+    return geo_store;
+}
+
+// How apply_geo looks for a slot that has not been written.
+// Both the cache file and backfill are used only if slot_id is a frame number.
+struct GeoFallback {
+    bool use_cache;
+    uint64_t fingerprint;  // Of the object in the cache file.
+    uint32_t backfill_frames;  // 0: no backfill.
+    uint32_t curr_frame;
+};
+
+// Read a saved frame from the store, then from the cache file.
+inline static bool
+read_saved_geo(uint64_t geo_key, uint32_t frame, const GeoFallback &fallback, Geometry &geo) {
+    auto &geo_store = get_geo_store();
+    return (geo_store->read(geo_key, frame, geo) && geo.is_valid) ||
+           (fallback.use_cache && geo_store->read_cache(geo_key, frame, fallback.fingerprint, geo) && geo.is_valid);
+}
+
+inline static Geometry
+lerp_geo(const Geometry &a, const Geometry &b, float t) {
+    auto lerp = [t](int32_t x, int32_t y) {
+        return static_cast<int32_t>(std::lround(static_cast<double>(x) + (static_cast<double>(y) - x) * t));
+    };
+    return Geometry(lerp(a.ox, b.ox), lerp(a.oy, b.oy), lerp(a.cx, b.cx), lerp(a.cy, b.cy), lerp(a.zoom, b.zoom),
+                    lerp(a.rz, b.rz));
+}
+
+// Fill a frame skipped by seeking, by interpolating between the nearest saved frames around it.
+// The frame after it is the current frame unless a closer one is saved. Nothing is filled if no frame before it is
+// saved within backfill_frames. The result is written to the store, so that it is computed only once.
+static bool
+backfill_geo(uint64_t geo_key, uint32_t frame, const GeoFallback &fallback, const Geometry &curr_geo, Geometry &geo) {
+    if (fallback.backfill_frames == 0u || frame >= fallback.curr_frame)
+        return false;
+
+    auto &geo_store = get_geo_store();
+    uint32_t lower = frame > fallback.backfill_frames ? frame - fallback.backfill_frames : 0u;
+
+    uint32_t prev_frame = 0u;
+    Geometry prev_geo;
+    bool has_prev = geo_store->find_prev(
+            geo_key, frame, fallback.backfill_frames, [](const Geometry &g) { return g.is_valid; }, prev_frame,
+            prev_geo);
+
+    // The cache file may have a closer one.
+    if (fallback.use_cache) {
+        for (uint32_t f = frame; f > (has_prev ? prev_frame + 1u : lower);) {
+            f--;
+
+            Geometry cached;
+            if (geo_store->read_cache(geo_key, f, fallback.fingerprint, cached) && cached.is_valid) {
+                prev_frame = f;
+                prev_geo = cached;
+                has_prev = true;
+                break;
+            }
+        }
+    }
+
+    if (!has_prev)
+        return false;
+
+    uint32_t next_frame = fallback.curr_frame;
+    Geometry next_geo = curr_geo;
+    for (uint32_t f = frame + 1u; f < fallback.curr_frame; f++) {
+        Geometry saved;
+        if (read_saved_geo(geo_key, f, fallback, saved)) {
+            next_frame = f;
+            next_geo = saved;
+            break;
+        }
+    }
+
+    float t = static_cast<float>(frame - prev_frame) / static_cast<float>(next_frame - prev_frame);
+    geo = lerp_geo(prev_geo, next_geo, t);
+    geo_store->write(geo_key, frame, geo);
+    return true;
 }
 
 // Apply geometry to the transform.
 inline static void
-apply_geo(Transform &tf, uint32_t shared_mem_key, uint32_t slot_id, const Geometry &default_geo) {
-    auto &shared_mem = get_shared_mem();
+apply_geo(Transform &tf, uint64_t geo_key, uint32_t slot_id, const Geometry &default_geo,
+          const GeoFallback &fallback) {
     Geometry geo;
 
-    if (shared_mem->read(shared_mem_key, slot_id, geo) && geo.is_valid)
+    if (read_saved_geo(geo_key, slot_id, fallback, geo))
+        tf.apply_geometry(geo);
+    else if (backfill_geo(geo_key, slot_id, fallback, default_geo, geo))
         tf.apply_geometry(geo);
     else
         tf.apply_geometry(default_geo);
 }
 
-// Calculate the transform before frame 0.
-inline static std::variant<Transform, std::array<Transform, 2>>
-calc_neg_frame(const std::array<Transform, 3> &tf_array, bool will_calc_2f = false) {
-    Transform d1 = tf_array[1] - tf_array[0];
-    Transform d2 = tf_array[2] - tf_array[1];
-    Transform tf_neg_1f = tf_array[0] - d1 * 2.0f + d2;
-
-    // Uniformly accelerated linear motion
-    if (will_calc_2f) {
-        return std::array<Transform, 2>{tf_neg_1f, tf_neg_1f - d1 * 3.0f + d2 * 2.0f};
-    } else {
-        return tf_neg_1f;
+// The obj_id in geo_key changes when objects are added, deleted or reordered, so the records of the cache file are
+// also tagged with what identifies the object on the timeline.
+static uint64_t
+make_geo_fingerprint(const ObjectUtils &obj_utils) {
+    uint64_t fingerprint = 0xcbf29ce484222325ull;  // FNV-1a over 32-bit values.
+    for (int32_t value : {obj_utils.get_scene(), obj_utils.get_layer(), obj_utils.get_frame_begin(),
+                          obj_utils.get_frame_end(), obj_utils.get_filter_id()}) {
+        fingerprint ^= static_cast<uint32_t>(value);
+        fingerprint *= 0x100000001b3ull;
     }
+
+    return fingerprint;
+}
+
+// The cache file is placed next to the project file.
+static std::filesystem::path
+get_geo_cache_path(const ObjectUtils &obj_utils) {
+    std::filesystem::path path = obj_utils.get_project_path();
+    if (!path.empty())
+        path += ".omb_geo";
+
+    return path;
 }
 
 // Calculate the amounticient that determines the length of the blur.
@@ -107,6 +209,59 @@ calc_samp(int required, int sample_limit, int total_req_samp) {
     return std::clamp(required, 1, static_cast<int>(std::max(ratio, 1.0f)));
 }
 
+// Jittered samples may step several pixels, because the noise hides the gaps.
+// The recursive doubling and the sliding window share their work among the pixels, so they have no jitter.
+inline static int
+calc_jitter_px(const ObjectMotionBlurParams &params) {
+    return params.accum_mode == AccumMode::Doubling || params.accum_mode == AccumMode::Sliding ? 0 : params.jitter;
+}
+
+// Standard switches to the polar remap of the sliding window by itself for a pure rotation or a pure zoom, but only
+// when the CPU engine renders anyway and no option that only Standard supports is on. Translations stay on Standard.
+static bool
+is_auto_sliding_enabled(lua_State *L, const ObjectMotionBlurParams &params, const SegmentData<Steps> &steps_data,
+                        const SegmentData<int> &samp_data) {
+    if (params.accum_mode != AccumMode::Standard || params.render_engine == RenderEngine::GPU || params.prefilter ||
+        params.jitter != 0 || !is_polar_plan(steps_data, samp_data))
+        return false;
+
+    return params.render_engine == RenderEngine::CPU || !GLShaderKit(L).isInitialized();
+}
+
+inline static constexpr int
+calc_jittered_samp(int required, int jitter_px) {
+    return jitter_px > 0 ? (required + jitter_px - 1) / jitter_px : required;
+}
+
+// Auto reduces large images with long blurs. The blur is low-frequency along the motion, and a long blur hides the
+// softening across it.
+inline static int
+calc_downscale(Downscale downscale, const Vec2<int> &size, int max_blur_px) {
+    constexpr int64_t half_pixels = 2560 * 1440;
+    constexpr int64_t quarter_pixels = 3840 * 2160;
+    constexpr int half_blur_px = 64;
+    constexpr int quarter_blur_px = 256;
+
+    switch (downscale) {
+        case Downscale::Off:
+            return 1;
+        case Downscale::Half:
+            return 2;
+        case Downscale::Quarter:
+            return 4;
+        default:
+            break;
+    }
+
+    int64_t pixels = static_cast<int64_t>(size.get_x()) * size.get_y();
+    if (pixels >= quarter_pixels && max_blur_px >= quarter_blur_px)
+        return 4;
+    if (pixels >= half_pixels && max_blur_px >= half_blur_px)
+        return 2;
+
+    return 1;
+}
+
 inline static Corner
 calc_corners(const Vec2<float> &base, const Vec2<float> &disp, const Vec2<float> &bbox_size, float offset_scale,
              const Vec2<int> &img_size) {
@@ -118,13 +273,13 @@ calc_corners(const Vec2<float> &base, const Vec2<float> &disp, const Vec2<float>
     return corner;
 }
 
-// Resize the image.
-static void
+// Resize the image. Returns the new size, which ExEdit clips to max_size.
+static Vec2<int>
 resize_image(const Vec2<int> &img_size, const Vec2<float> &center, const SegmentData<Displacements> &disp,
              const SegmentData<float> &blur, const Steps &offset, float scale_factor_seg1, const Vec2<int> &max_size,
              lua_State *L) {
     if (!disp.seg1 || !blur.seg1) {
-        return;
+        return img_size;
     }
 
     float offset_scale_inv = 1.0f / offset.scale;
@@ -170,65 +325,313 @@ resize_image(const Vec2<int> &img_size, const Vec2<float> &center, const Segment
     }
 
     expand_image(expansion, L);
+    return Vec2<int>(std::min(new_size.get_x(), max_size.get_x()), std::min(new_size.get_y(), max_size.get_y()));
 }
 
-// Rendering.
-static void
-render_object_motion_blur(lua_State *L, const ObjectMotionBlurParams &params, const SegmentData<Steps> &steps_data,
-                          const SegmentData<int> &samp_data) {
-    std::filesystem::path shader_path = get_self_dir() / params.shader_dir.relative_path() / "MotionBlur_K.frag";
-    if (!std::filesystem::exists(shader_path))
-        throw std::runtime_error("Shader file not found: " + shader_path.string());
+// Get frame planner class.
+static FramePlanner &
+get_frame_planner() {
+    static FramePlanner frame_planner;
+    return frame_planner;
+}
 
-    GLShaderKit gl_shader_kit(L);
-    if (!gl_shader_kit.isInitialized())
-        throw std::runtime_error("GL Shader Kit is not available.");
+// Get CPU renderer class.
+static std::unique_ptr<CpuRenderer> &
+get_cpu_renderer() {
+    static std::unique_ptr<CpuRenderer> cpu_renderer = std::make_unique<CpuRenderer>();
+    return cpu_renderer;
+}
+
+// Get shader cache class.
+static ShaderCache &
+get_shader_cache() {
+    static ShaderCache shader_cache;
+    return shader_cache;
+}
+
+// Select the variant of the standard shader for the plan.
+static uint32_t
+select_shader_variant(const SegmentData<Steps> &steps_data, const SegmentData<int> &samp_data, AccumMode accum_mode,
+                      bool mix_orig_img) {
+    uint32_t variant = 0u;
+    if (steps_data.seg2 && samp_data.seg2 && *samp_data.seg2 != 0)
+        variant |= ShaderCache::VARIANT_TWO_SEGMENTS;
+    if (accum_mode == AccumMode::Reconstruct)
+        variant |= ShaderCache::VARIANT_RECONSTRUCT;
+    else if (is_translation_plan(steps_data, samp_data))
+        variant |= ShaderCache::VARIANT_TRANSLATION;
+    else if (accum_mode == AccumMode::Adaptive)
+        variant |= ShaderCache::VARIANT_ADAPTIVE;
+    if (mix_orig_img)
+        variant |= ShaderCache::VARIANT_BLEND;
+
+    return variant;
+}
 
-    Image img = gl_shader_kit.get_image();
+// Largest image the GPU renders at once. A larger one is rendered in tiles of this size, each of which uploads only the
+// region of the image its chains fetch, so that neither the textures nor the draw target outgrow the GPU.
+static constexpr int GPU_TILE_SIZE = 2048;
+
+// Buffers of the tiled rendering on the GPU: the original image, the cropped regions of it and of the prefiltered
+// sources, and the output of a tile.
+static std::array<std::vector<ExEdit::PixelBGRA>, 5> &
+get_gpu_tile_buffers() {
+    static std::array<std::vector<ExEdit::PixelBGRA>, 5> buffers;
+    return buffers;
+}
+
+// Copy rect of img into buffer. The returned image keeps the pivot of img at the same pixel of the object.
+static Image
+crop_image(const Image &img, const PixelRect &rect, std::vector<ExEdit::PixelBGRA> &buffer) {
+    Vec2<int> size(rect.get_w(), rect.get_h());
+    buffer.resize(static_cast<size_t>(size.get_x()) * size.get_y());
+    for (int y = 0; y < size.get_y(); y++) {
+        const ExEdit::PixelBGRA *row = img.data + static_cast<size_t>(rect.y0 + y) * img.size.get_x() + rect.x0;
+        std::copy(row, row + size.get_x(), buffer.data() + static_cast<size_t>(y) * size.get_x());
+    }
+
+    Vec2<float> pivot = img.center + static_cast<Vec2<float>>(img.size) * 0.5f;
+    Vec2<float> origin(static_cast<float>(rect.x0), static_cast<float>(rect.y0));
+    return Image{size, pivot - origin - static_cast<Vec2<float>>(size) * 0.5f, buffer.data()};
+}
+
+// Rendering on the GPU.
+static void
+render_object_motion_blur_gpu(GLShaderKit &gl_shader_kit, const ObjectMotionBlurParams &params, Image &img,
+                              const SegmentData<Steps> &steps_data, const SegmentData<int> &samp_data,
+                              AccumMode accum_mode, bool mix_orig_img) {
+    // The prefilter runs on the CPU, and the chains sample its results from texture units 1 and 2.
+    SegmentData<Image> sources;
+    if (params.prefilter && accum_mode == AccumMode::Standard)
+        sources = get_cpu_renderer()->prefilter(img, steps_data, samp_data);
+
+    auto &shader_cache = get_shader_cache();
+    if (params.reload_shader)
+        shader_cache.poll_modified(ShaderId::Standard);
+    uint32_t variant = select_shader_variant(steps_data, samp_data, accum_mode, mix_orig_img);
+    if (sources.seg1)
+        variant |= ShaderCache::VARIANT_PREFILTER;
+    if (calc_jitter_px(params) > 0)
+        variant |= ShaderCache::VARIANT_JITTER;
+    const std::string &shader_path = shader_cache.get_path(params.shader_dir, ShaderId::Standard, variant);
 
     gl_shader_kit.activate();
     gl_shader_kit.setPlaneVertex(1);
-    gl_shader_kit.setShader(shader_path.string(), params.reload_shader);
+    gl_shader_kit.setShader(shader_path, false);
+
+    // The per-pixel plans are made for the whole image, so the tiles agree on them.
+    Vec2<float> resolution = static_cast<Vec2<float>>(img.size);
+    Vec2<float> pivot = img.center + resolution * 0.5f;
+    if (variant & ShaderCache::VARIANT_ADAPTIVE)
+        gl_shader_kit.setParamsForOMBAdaptive(make_adaptive_plan(steps_data, samp_data, resolution, pivot));
+    if (variant & ShaderCache::VARIANT_RECONSTRUCT)
+        gl_shader_kit.setParamsForOMBReconstruct(make_velocity_maps(steps_data, samp_data));
+
+    const PixelRect whole = {0, 0, img.size.get_x(), img.size.get_y()};
+    if (img.size.get_x() <= GPU_TILE_SIZE && img.size.get_y() <= GPU_TILE_SIZE) {
+        gl_shader_kit.setTexture2D(0, img);
+        if (sources.seg1) {
+            gl_shader_kit.setTexture2D(1, *sources.seg1);
+            if (sources.seg2)
+                gl_shader_kit.setTexture2D(2, *sources.seg2);
+        }
+        gl_shader_kit.setParamsForOMB(pivot, steps_data, samp_data, whole, whole);
+        gl_shader_kit.draw("TRIANGLE_STRIP", img);
+        gl_shader_kit.deactivate();
+        return;
+    }
+
+    // The tiles are written back into img, so the regions are cropped from a copy of it.
+    auto &buffers = get_gpu_tile_buffers();
+    buffers[0].assign(img.data, img.data + static_cast<size_t>(img.size.get_x()) * img.size.get_y());
+    const Image orig_img = {img.size, img.center, buffers[0].data()};
+    for (const PixelRect &tile : make_tiles(img.size, GPU_TILE_SIZE)) {
+        PixelRect region = calc_source_rect(steps_data, samp_data, tile, img.size, pivot);
+        gl_shader_kit.setTexture2D(0, crop_image(orig_img, region, buffers[1]));
+        if (sources.seg1) {
+            gl_shader_kit.setTexture2D(1, crop_image(*sources.seg1, region, buffers[2]));
+            if (sources.seg2)
+                gl_shader_kit.setTexture2D(2, crop_image(*sources.seg2, region, buffers[3]));
+        }
+        gl_shader_kit.setParamsForOMB(pivot, steps_data, samp_data, region, tile);
+
+        buffers[4].resize(static_cast<size_t>(tile.get_w()) * tile.get_h());
+        Image output = {Vec2<int>(tile.get_w(), tile.get_h()), Vec2<float>(), buffers[4].data()};
+        gl_shader_kit.draw("TRIANGLE_STRIP", output);
+        for (int y = 0; y < tile.get_h(); y++) {
+            const ExEdit::PixelBGRA *row = output.data + static_cast<size_t>(y) * tile.get_w();
+            size_t dst = static_cast<size_t>(tile.y0 + y) * img.size.get_x() + tile.x0;
+            std::copy(row, row + tile.get_w(), img.data + dst);
+        }
+    }
+    gl_shader_kit.deactivate();
+}
+
+// Intermediate images of the doubling passes on the GPU.
+static std::array<std::vector<ExEdit::PixelBGRA>, 3> &
+get_gpu_pass_buffers() {
+    static std::array<std::vector<ExEdit::PixelBGRA>, 3> buffers;
+    return buffers;
+}
+
+// Run the doubling passes of one segment. Returns the image (ping or pong) that holds the averaged chain.
+static Image &
+run_gpu_doubling_passes(GLShaderKit &gl_shader_kit, const Image &img, const Affine2<float> &step_map, int samples,
+                        Image &ping, Image &pong) {
+    Affine2<float> map = samples <= 1 ? Affine2<float>() : step_map;
+    int pass_count = std::max(calc_doubling_passes(samples), 1);
+    Image *target = &ping;
+    Image *source = &pong;
 
     gl_shader_kit.setTexture2D(0, img);
+    for (int m = 0; m < pass_count; m++) {
+        gl_shader_kit.setInt("pass_type", {m == 0 ? 0 : 1});
+        gl_shader_kit.setParamsForAffine("map", map);
+        gl_shader_kit.draw("TRIANGLE_STRIP", *target);
+
+        if (m + 1 < pass_count)
+            gl_shader_kit.setTexture2D(0, *target);
+
+        std::swap(target, source);
+        map = map * map;
+    }
+
+    return *source;
+}
+
+// Rendering on the GPU with recursive doubling.
+// The passes are read back into 8-bit buffers, so very faint tails lose some color precision compared to the CPU.
+static void
+render_object_motion_blur_gpu_doubling(GLShaderKit &gl_shader_kit, const ObjectMotionBlurParams &params, Image &img,
+                                       const SegmentData<Steps> &steps_data, const SegmentData<int> &samp_data,
+                                       bool mix_orig_img) {
+    auto &shader_cache = get_shader_cache();
+    if (params.reload_shader)
+        shader_cache.poll_modified(ShaderId::Doubling);
+    const std::string &shader_path = shader_cache.get_path(params.shader_dir, ShaderId::Doubling);
+    const size_t pixel_count = static_cast<size_t>(img.size.get_x()) * img.size.get_y();
+
+    auto &buffers = get_gpu_pass_buffers();
+    std::array<Image, 3> pass_images;
+    for (size_t i = 0; i < buffers.size(); i++) {
+        buffers[i].resize(pixel_count);
+        pass_images[i] = Image{img.size, img.center, buffers[i].data()};
+    }
+
+    const Steps &seg1 = *steps_data.seg1;
+    const int seg1_samples = *samp_data.seg1;
+    const bool has_seg2 = steps_data.seg2 && samp_data.seg2 && *samp_data.seg2 != 0;
+
+    gl_shader_kit.activate();
+    gl_shader_kit.setPlaneVertex(1);
+    gl_shader_kit.setShader(shader_path, false);
+
     Vec2<float> resolution = static_cast<Vec2<float>>(img.size);
     Vec2<float> pivot = img.center + resolution * 0.5f;
     gl_shader_kit.setFloat("resolution", {resolution.get_x(), resolution.get_y()});
     gl_shader_kit.setFloat("pivot", {pivot.get_x(), pivot.get_y()});
-    gl_shader_kit.setInt("is_orig_img_visible", {params.mix_orig_img});
-    gl_shader_kit.setInt("samples", {*samp_data.seg1, samp_data.seg2 ? *samp_data.seg2 : 0});
 
-    gl_shader_kit.setParamsForOMBStep("offset", *steps_data.offset);
-    gl_shader_kit.setParamsForOMBStep("seg1", *steps_data.seg1);
-    if (steps_data.seg2)
-        gl_shader_kit.setParamsForOMBStep("seg2", *steps_data.seg2);
+    Image &seg1_image = run_gpu_doubling_passes(gl_shader_kit, img, make_fixed_step_map(seg1), seg1_samples,
+                                                pass_images[0], pass_images[1]);
+    Image *seg2_image = &seg1_image;
+
+    if (has_seg2) {
+        Image &spare = &seg1_image == &pass_images[0] ? pass_images[1] : pass_images[0];
+        seg2_image = &run_gpu_doubling_passes(gl_shader_kit, img, make_fixed_step_map(*steps_data.seg2),
+                                              *samp_data.seg2, spare, pass_images[2]);
+        gl_shader_kit.setParamsForAffine("seg2", make_fixed_step_map(*steps_data.seg2)
+                                                         * make_chain_end_map(seg1, seg1_samples));
+    }
+
+    // Composite.
+    gl_shader_kit.setTexture2D(0, img);
+    gl_shader_kit.setTexture2D(1, seg1_image);
+    gl_shader_kit.setTexture2D(2, *seg2_image);
+    gl_shader_kit.setInt("pass_type", {2});
+    gl_shader_kit.setInt("is_orig_img_visible", {mix_orig_img});
+    gl_shader_kit.setInt("samples", {seg1_samples, has_seg2 ? *samp_data.seg2 : 0});
+    gl_shader_kit.setParamsForAffine("offset", make_offset_map(*steps_data.offset));
+    gl_shader_kit.setParamsForAffine("seg1", make_fixed_step_map(seg1));
 
     gl_shader_kit.draw("TRIANGLE_STRIP", img);
     gl_shader_kit.deactivate();
+}
+
+// Rendering on the CPU.
+static void
+render_object_motion_blur_cpu(const ObjectMotionBlurParams &params, Image &img, const SegmentData<Steps> &steps_data,
+                              const SegmentData<int> &samp_data, AccumMode accum_mode, bool mix_orig_img) {
+    get_cpu_renderer()->render(img, steps_data, samp_data, mix_orig_img, accum_mode, params.prefilter,
+                               calc_jitter_px(params) > 0);
+}
+
+// Rendering.
+// Auto uses GLShaderKit when it is available and falls back to the CPU engine otherwise.
+// The sliding window runs only on the CPU, because its prefix sums need more than the 8 bits of the textures.
+static void
+render_to_image(lua_State *L, const ObjectMotionBlurParams &params, Image &img, const SegmentData<Steps> &steps_data,
+                const SegmentData<int> &samp_data, AccumMode accum_mode, bool mix_orig_img) {
+    // The doubling passes are not tiled, so an image too large for the GPU is doubled on the CPU.
+    bool is_oversized = img.size.get_x() > GPU_TILE_SIZE || img.size.get_y() > GPU_TILE_SIZE;
+    if (params.render_engine == RenderEngine::CPU || accum_mode == AccumMode::Sliding ||
+        (accum_mode == AccumMode::Doubling && is_oversized)) {
+        render_object_motion_blur_cpu(params, img, steps_data, samp_data, accum_mode, mix_orig_img);
+        return;
+    }
+
+    GLShaderKit gl_shader_kit(L);
+    if (gl_shader_kit.isInitialized()) {
+        if (accum_mode == AccumMode::Doubling)
+            render_object_motion_blur_gpu_doubling(gl_shader_kit, params, img, steps_data, samp_data, mix_orig_img);
+        else
+            render_object_motion_blur_gpu(gl_shader_kit, params, img, steps_data, samp_data, accum_mode, mix_orig_img);
+    } else if (params.render_engine == RenderEngine::Auto) {
+        render_object_motion_blur_cpu(params, img, steps_data, samp_data, accum_mode, mix_orig_img);
+    } else {
+        const std::string &load_error = gl_shader_kit.getLoadError();
+        throw std::runtime_error(load_error.empty() ? "GL Shader Kit is not available."
+                                                    : "GL Shader Kit is not available: " + load_error);
+    }
+}
 
-    gl_shader_kit.putpixeldata(img.data);
+// A reduced image is rendered without the original, which is blended at full resolution after the upsampling.
+static void
+render_object_motion_blur(lua_State *L, const ObjectMotionBlurParams &params, const SegmentData<Steps> &steps_data,
+                          const SegmentData<int> &samp_data, AccumMode accum_mode, int downscale) {
+    Image img = get_image(L);
+    if (downscale <= 1) {
+        render_to_image(L, params, img, steps_data, samp_data, accum_mode, params.mix_orig_img);
+    } else {
+        CpuRenderer &cpu_renderer = *get_cpu_renderer();
+        Image reduced = cpu_renderer.downsample(img, downscale);
+        render_to_image(L, params, reduced, scale_plan(steps_data, 1.0f / static_cast<float>(downscale)), samp_data,
+                        accum_mode, false);
+        cpu_renderer.upsample(reduced, downscale, img, params.mix_orig_img);
+    }
+
+    put_image(img.data, L);
 }
 
 // Save Geometry data to shared memory. (4, 3)
 static void
-save_minimal_geo(int32_t shared_mem_key, const Geometry &default_geo) {
+save_minimal_geo(uint64_t geo_key, const Geometry &default_geo) {
     Geometry geo_prev_1f;
-    auto &shared_mem = get_shared_mem();
+    auto &geo_store = get_geo_store();
 
-    if (shared_mem->read(shared_mem_key, 4u, geo_prev_1f))
-        shared_mem->write(shared_mem_key, 3u, geo_prev_1f);
+    if (geo_store->read(geo_key, 4u, geo_prev_1f))
+        geo_store->write(geo_key, 3u, geo_prev_1f);
     else
-        shared_mem->write(shared_mem_key, 3u, default_geo);
+        geo_store->write(geo_key, 3u, default_geo);
 
-    shared_mem->write(shared_mem_key, 4u, default_geo);
+    geo_store->write(geo_key, 4u, default_geo);
 }
 
 // Clear handle.
 static void
-cleanup_geo(bool is_geo_used, int method, bool is_last_frame, uint16_t obj_id) {
-    auto &shared_mem = get_shared_mem();
-    constexpr uint32_t key1_mask = 0x3FFFu;  // 14 bits for object index.
-    uint32_t match_bits = static_cast<uint32_t>(obj_id) & key1_mask;
+cleanup_geo(bool is_geo_used, int method, bool is_last_frame, uint16_t obj_id, uint16_t filter_idx) {
+    auto &geo_store = get_geo_store();
+    constexpr uint64_t key1_mask = GEO_KEY_FILTER_MASK;  // This filter of this object.
+    uint64_t match_bits = make_geo_key(obj_id, filter_idx, 0);
 
     if (is_geo_used) {
         switch (method) {
@@ -236,22 +639,56 @@ cleanup_geo(bool is_geo_used, int method, bool is_last_frame, uint16_t obj_id) {
                 break;  // pass
             case 2:
                 if (is_last_frame)
-                    shared_mem->cleanup_for_key1_mask(match_bits, key1_mask);
+                    geo_store->cleanup_for_key1_mask(match_bits, key1_mask);
 
                 break;
             case 3:
-                shared_mem->cleanup_all_handle();
+                geo_store->cleanup_all_handle();
+                geo_store->clear_cache();
                 break;
             case 4:
-                shared_mem->cleanup_for_key1_mask(match_bits, key1_mask);
+                geo_store->cleanup_for_key1_mask(match_bits, key1_mask);
                 break;
             default:
-                uint32_t id = static_cast<uint32_t>(std::clamp(std::abs(static_cast<int64_t>(method)), 0i64, 15000i64));
-                shared_mem->cleanup_for_key1_mask(id, key1_mask);
+                uint16_t id = static_cast<uint16_t>(std::clamp(std::abs(static_cast<int64_t>(method)), 0i64, 15000i64));
+                geo_store->cleanup_for_key1_mask(make_geo_key(id, 0u, 0), GEO_KEY_OBJECT_MASK);
                 break;
         }
-    } else if (shared_mem->has_key1(match_bits)) {
-        shared_mem->cleanup_for_key1_mask(match_bits, key1_mask);
+    } else if (geo_store->has_key1(match_bits)) {
+        geo_store->cleanup_for_key1_mask(match_bits, key1_mask);
+    }
+}
+
+// Turning Clear Cache on starts the cache file over once. Each filter keeps its own state, so that filters with
+// different settings don't clear the file every frame.
+static void
+clear_geo_cache_on_request(bool use_geo_cache, bool clear_geo_cache, uint64_t filter_key) {
+    static std::unordered_set<uint64_t> clearing_filters;
+
+    if (!clear_geo_cache) {
+        clearing_filters.erase(filter_key);
+        return;
+    }
+
+    if (clearing_filters.insert(filter_key).second && use_geo_cache)
+        get_geo_store()->clear_cache();
+}
+
+// Print the objects whose geometry data was evicted to fit in the budget. The evictions are taken either way, so that
+// they don't pile up while Print Info is off.
+static void
+report_geo_evictions(bool print_info) {
+    auto &geo_store = get_geo_store();
+
+    const auto evictions = geo_store->take_evictions();
+    if (!print_info)
+        return;
+
+    for (const auto &eviction : evictions) {
+        uint64_t evicted_id = eviction.group >> (GEO_KEY_INDEX_BITS + GEO_KEY_FILTER_BITS);
+        std::cout << "[ObjectMotionBlur][INFO] Evicted geometry data to fit in Geo Budget.\nObject ID: " << evicted_id
+                  << ", Size: " << (eviction.bytes >> 10) << " KiB, Used: " << (geo_store->get_used_bytes() >> 10)
+                  << " KiB" << std::endl;
     }
 }
 
@@ -260,11 +697,19 @@ int
 process_object_motion_blur(lua_State *L) {
     try {
         // Create instances.
-        auto &shared_mem = get_shared_mem();
+        auto &geo_store = get_geo_store();
         ObjectUtils obj_utils;
         ObjectMotionBlurParams params(L, obj_utils.get_is_saving());
+        get_shader_cache().begin_frame(obj_utils.get_frame_num());
+
+        // Objects with the cache turned off leave the file open for the others.
+        bool use_geo_cache = params.use_geo && params.geo_cache != GeoCacheMode::Off;
+        if (use_geo_cache && geo_store->set_cache(get_geo_cache_path(obj_utils), params.geo_cache) &&
+            !geo_store->is_cache_open())
+            std::cout << WARNING_COL << "[ObjectMotionBlur][WARNING] Failed to open the geometry cache file. "
+                      << "Save the project first when using Geo Cache." << RESET_COL << std::endl;
 
-        if (params.use_geo && obj_utils.get_obj_num() > 262144)  // 2^18
+        if (params.use_geo && obj_utils.get_obj_num() > 1048576)  // 2^20
             std::cout << WARNING_COL << "[ObjectMotionBlur][WARNING] There are too many individual objects."
                       << RESET_COL << std::endl;
 
@@ -272,26 +717,49 @@ process_object_motion_blur(lua_State *L) {
         bool is_last_frame = obj_utils.get_frame_num() == obj_utils.get_frame_end();
         bool is_last_obj_index = obj_utils.get_obj_index() == (obj_utils.get_obj_num() - 1);
         uint16_t obj_id = obj_utils.get_curr_object_idx();
+        uint16_t filter_idx = obj_utils.get_curr_filter_idx();
         int32_t local_frame = obj_utils.get_local_frame();
 
-        uint32_t shared_mem_key = make_shared_mem_key(obj_id, obj_utils.get_obj_index());
+        uint64_t geo_key = make_geo_key(obj_id, filter_idx, obj_utils.get_obj_index());
+        clear_geo_cache_on_request(use_geo_cache, params.clear_geo_cache, make_geo_key(obj_id, filter_idx, 0));
+
+        // The settings belong to this filter. Geo Budget is shared by all objects, and the smallest one applies.
+        if (params.use_geo) {
+            GeoSettings geo_settings;
+            geo_settings.backend = params.geo_backend;
+            geo_settings.window_frames = params.save_all_geo ? static_cast<uint32_t>(params.geo_window) : 0u;
+            geo_settings.spill_policy = params.geo_spill;
+            geo_settings.budget_bytes = static_cast<size_t>(params.geo_budget_mb) << 20;
+            geo_store->set_settings(geo_key, geo_settings);
+        }
         uint32_t base_slot_id = params.save_all_geo ? std::max(local_frame - 1, 0) : 4u;
         const auto &data = obj_utils.get_obj_data();
         Geometry geo_curr_f = {data.ox, data.oy, data.cx, data.cy, data.zoom, data.rz};
 
+        // Slots 0 to 2 are always frame numbers. The others are frame numbers only if all geometry is saved.
+        uint64_t geo_fingerprint = use_geo_cache ? make_geo_fingerprint(obj_utils) : 0u;
+        GeoFallback frame_fallback = {use_geo_cache, geo_fingerprint, static_cast<uint32_t>(params.geo_backfill),
+                                      static_cast<uint32_t>(local_frame)};
+        GeoFallback slot_fallback = params.save_all_geo ? frame_fallback : GeoFallback{false, 0u, 0u, 0u};
+
         auto update_geo = [&]() {
             // Save geometry data.
             // This section is executed only when "Save All Geo" is disabled.
             if (params.use_geo && !params.save_all_geo && obj_utils.get_camera_mode() != 3)
-                save_minimal_geo(shared_mem_key, geo_curr_f);
+                save_minimal_geo(geo_key, geo_curr_f);
 
             // Cleanup.
             if (is_last_obj_index)
-                cleanup_geo(params.use_geo, params.geo_cleanup_method, is_last_frame, obj_id);
+                cleanup_geo(params.use_geo, params.geo_cleanup_method, is_last_frame, obj_id, filter_idx);
+
+            report_geo_evictions(params.print_info);
         };
 
-        if (params.use_geo && (params.save_all_geo || local_frame <= 2))
-            shared_mem->write(shared_mem_key, local_frame, geo_curr_f);
+        if (params.use_geo && (params.save_all_geo || local_frame <= 2)) {
+            geo_store->write(geo_key, local_frame, geo_curr_f);
+            if (use_geo_cache)
+                geo_store->write_cache(geo_key, local_frame, geo_fingerprint, geo_curr_f);
+        }
 
         // Invalid value.
         if (are_equal(params.shutter_angle, 0.0f)) {
@@ -319,68 +787,57 @@ process_object_motion_blur(lua_State *L) {
         Vec2<float> center(obj_utils.get_cx(), obj_utils.get_cy());
 
         // calculate the displacements.
-        if (params.calc_neg_f && local_frame <= 1) {
-            std::array<Transform, 3> tf_array = {Transform(obj_utils, 0, OffsetType::Start),
-                                                 Transform(obj_utils, 1, OffsetType::Start),
-                                                 Transform(obj_utils, 2, OffsetType::Start)};
-
-            if (params.use_geo) {
-                for (auto &tf : tf_array) {
-                    apply_geo(tf, shared_mem_key, &tf - tf_array.data(), geo_curr_f);
-                }
+        // The trackbar transforms are shared by all individual objects. Only the center and the geometry are their own.
+        bool is_start_plan = params.calc_neg_f && local_frame <= 1;
+        if (is_start_plan || local_frame != 0) {
+            const FramePlan &plan = get_frame_planner().get_plan(obj_utils, is_start_plan, should_calc_prev_2f);
+            std::array<Transform, 3> tf_array = plan.tfs;
+            std::array<Transform, 2> tf_neg_array = plan.tfs_neg;
+            for (auto &tf : tf_array) {
+                tf.set_center(center);
             }
-
-            // Calculate displacements from transforms.
-            // Calculate frames that do not actually exist.
-            if (local_frame == 0) {
-                auto tf_neg_f = calc_neg_frame(tf_array, should_calc_prev_2f);
-                std::visit(
-                        [&](auto &&tf) {
-                            if constexpr (std::is_same_v<std::decay_t<decltype(tf)>, Transform>) {
-                                disp_data.seg1 = Displacements(tf_array[0], tf);
-                            } else {
-                                auto &[neg_1f, neg_2f] = tf;
-                                disp_data.seg1 = Displacements(tf_array[0], neg_1f);
-                                disp_data.seg2 = Displacements(neg_1f, neg_2f);
-                            }
-                        },
-                        tf_neg_f);
-            } else {
-                if (!should_calc_prev_2f) {
-                    disp_data.seg1 = Displacements(tf_array[1], tf_array[0]);
-                } else {
-                    auto tf_neg_f = calc_neg_frame(tf_array);
-                    std::visit(
-                            [&](auto &&tf) {
-                                if constexpr (std::is_same_v<std::decay_t<decltype(tf)>, Transform>) {
-                                    disp_data.seg1 = Displacements(tf_array[1], tf_array[0]);
-                                    disp_data.seg2 = Displacements(tf_array[0], tf);
-                                } else {
-                                    throw std::runtime_error("Unexpected variant type in tf_neg_f.");
-                                }
-                            },
-                            tf_neg_f);
-                }
+            for (auto &tf : tf_neg_array) {
+                tf.set_center(center);
             }
-        } else if (local_frame != 0) {  // Default case.
-            Transform tf_curr_f = Transform(obj_utils);
-            Transform tf_prev_1f = Transform(obj_utils, -1);
 
-            if (params.use_geo) {
-                tf_curr_f.apply_geometry(geo_curr_f);
-                apply_geo(tf_prev_1f, shared_mem_key, base_slot_id, geo_curr_f);
-            }
+            if (is_start_plan) {
+                if (params.use_geo) {
+                    for (auto &tf : tf_array) {
+                        apply_geo(tf, geo_key, &tf - tf_array.data(), geo_curr_f, frame_fallback);
+                    }
 
-            disp_data.seg1 = Displacements(tf_curr_f, tf_prev_1f);
+                    tf_neg_array = calc_neg_frames(tf_array);
+                }
 
-            if (should_calc_prev_2f) {
-                Transform tf_prev_2f = Transform(obj_utils, -2);
+                // Calculate displacements from transforms.
+                // Calculate frames that do not actually exist.
+                const auto &[tf_neg_1f, tf_neg_2f] = tf_neg_array;
+                if (local_frame == 0) {
+                    disp_data.seg1 = Displacements(tf_array[0], tf_neg_1f);
+                    if (should_calc_prev_2f)
+                        disp_data.seg2 = Displacements(tf_neg_1f, tf_neg_2f);
+                } else {
+                    disp_data.seg1 = Displacements(tf_array[1], tf_array[0]);
+                    if (should_calc_prev_2f)
+                        disp_data.seg2 = Displacements(tf_array[0], tf_neg_1f);
+                }
+            } else {  // Default case.
+                auto &[tf_curr_f, tf_prev_1f, tf_prev_2f] = tf_array;
 
                 if (params.use_geo) {
-                    apply_geo(tf_prev_2f, shared_mem_key, base_slot_id - 1u, geo_curr_f);
+                    tf_curr_f.apply_geometry(geo_curr_f);
+                    apply_geo(tf_prev_1f, geo_key, base_slot_id, geo_curr_f, slot_fallback);
                 }
 
-                disp_data.seg2 = Displacements(tf_prev_1f, tf_prev_2f);
+                disp_data.seg1 = Displacements(tf_curr_f, tf_prev_1f);
+
+                if (should_calc_prev_2f) {
+                    if (params.use_geo) {
+                        apply_geo(tf_prev_2f, geo_key, base_slot_id - 1u, geo_curr_f, slot_fallback);
+                    }
+
+                    disp_data.seg2 = Displacements(tf_prev_1f, tf_prev_2f);
+                }
             }
         }
 
@@ -396,14 +853,19 @@ process_object_motion_blur(lua_State *L) {
 
         // Calculate the required samples.
         blur_amt_data.seg1 = calc_blur_amt(params.shutter_angle);
-        req_samp_data.seg1 = disp_data.seg1->calc_required_samples(*blur_amt_data.seg1, image_size, 1.0f);
+        // Without jitter, a sample per pixel of the motion is required.
+        const int jitter_px = calc_jitter_px(params);
+        int max_blur_px = disp_data.seg1->calc_required_samples(*blur_amt_data.seg1, image_size, 1.0f);
+        req_samp_data.seg1 = calc_jittered_samp(max_blur_px, jitter_px);
         int total_req_samp = *req_samp_data.seg1;
 
         if (can_render_prev_2f) {
             blur_amt_data.seg2 = calc_blur_amt(params.shutter_angle, true);
-            req_samp_data.seg2 =
+            int seg2_blur_px =
                     disp_data.seg2->calc_required_samples(*blur_amt_data.seg2, image_size, scale_factor_seg1);
+            req_samp_data.seg2 = calc_jittered_samp(seg2_blur_px, jitter_px);
             total_req_samp = *req_samp_data.seg1 + *req_samp_data.seg2;
+            max_blur_px = std::max(max_blur_px, seg2_blur_px);
         }
 
         // Invalid value.
@@ -423,13 +885,73 @@ process_object_motion_blur(lua_State *L) {
                     disp_data.seg2->calc_steps(*blur_amt_data.seg2, *samp_data.seg2, steps_data.offset->rz_rad);
         }
 
+        // Recursive doubling works only on fixed affine chains. Other plans are rendered as usual.
+        // Its cost grows with log2(samples), so the samples are rounded up to a power of two.
+        AccumMode accum_mode = AccumMode::Standard;
+        if (params.accum_mode == AccumMode::Doubling && can_double_plan(steps_data, samp_data)) {
+            accum_mode = AccumMode::Doubling;
+            samp_data.seg1 = round_doubling_samples(*samp_data.seg1);
+            steps_data.seg1 =
+                    disp_data.seg1->calc_steps(*blur_amt_data.seg1, *samp_data.seg1, steps_data.offset->rz_rad);
+
+            if (can_render_prev_2f) {
+                samp_data.seg2 = round_doubling_samples(*samp_data.seg2);
+                steps_data.seg2 =
+                        disp_data.seg2->calc_steps(*blur_amt_data.seg2, *samp_data.seg2, steps_data.offset->rz_rad);
+            }
+        } else if (params.accum_mode == AccumMode::Adaptive && !is_translation_plan(steps_data, samp_data)) {
+            // A translation moves every pixel equally, so only rotation and zoom benefit.
+            accum_mode = AccumMode::Adaptive;
+        } else if ((params.accum_mode == AccumMode::Sliding && is_sliding_plan(steps_data, samp_data)) ||
+                   is_auto_sliding_enabled(L, params, steps_data, samp_data)) {
+            // The sliding window costs the same for any number of samples, so the sample limit does not apply.
+            accum_mode = AccumMode::Sliding;
+            samp_data.seg1 = std::max(*req_samp_data.seg1, 1);
+            steps_data.seg1 =
+                    disp_data.seg1->calc_steps(*blur_amt_data.seg1, *samp_data.seg1, steps_data.offset->rz_rad);
+
+            if (can_render_prev_2f) {
+                samp_data.seg2 = std::max(*req_samp_data.seg2, 1);
+                steps_data.seg2 =
+                        disp_data.seg2->calc_steps(*blur_amt_data.seg2, *samp_data.seg2, steps_data.offset->rz_rad);
+            }
+        } else if (params.accum_mode == AccumMode::Reconstruct && can_reconstruct_plan(steps_data, samp_data)) {
+            // The taps are bounded per pixel, so the samples only weight the segments against each other.
+            accum_mode = AccumMode::Reconstruct;
+        }
+
         // Resize.
+        Vec2<int> render_size = image_size;
         if (!params.keep_size)
-            resize_image(image_size, center, disp_data, blur_amt_data, *steps_data.offset, scale_factor_seg1,
-                         Vec2<int>(obj_utils.get_max_w(), obj_utils.get_max_h()), L);
+            render_size = resize_image(image_size, center, disp_data, blur_amt_data, *steps_data.offset,
+                                       scale_factor_seg1, Vec2<int>(obj_utils.get_max_w(), obj_utils.get_max_h()), L);
+
+        // Reduced resolution. The motion of the reduced image is downscale times shorter, so it requires fewer samples.
+        // The sliding window costs the same for any number of samples.
+        const int downscale = calc_downscale(params.downscale, render_size, max_blur_px);
+        if (downscale > 1 && accum_mode != AccumMode::Sliding) {
+            auto reduce_samples = [downscale, accum_mode](int samples, int required) {
+                int reduced = std::clamp((required + downscale - 1) / downscale, 1, std::max(samples, 1));
+                return accum_mode == AccumMode::Doubling ? round_doubling_samples(reduced) : reduced;
+            };
+
+            samp_data.seg1 = reduce_samples(*samp_data.seg1, *req_samp_data.seg1);
+            steps_data.seg1 =
+                    disp_data.seg1->calc_steps(*blur_amt_data.seg1, *samp_data.seg1, steps_data.offset->rz_rad);
+
+            if (can_render_prev_2f) {
+                samp_data.seg2 = reduce_samples(*samp_data.seg2, *req_samp_data.seg2);
+                steps_data.seg2 =
+                        disp_data.seg2->calc_steps(*blur_amt_data.seg2, *samp_data.seg2, steps_data.offset->rz_rad);
+            }
+        }
 
         // Rendering.
-        render_object_motion_blur(L, params, steps_data, samp_data);
+        render_object_motion_blur(L, params, steps_data, samp_data, accum_mode, downscale);
+
+        // Frames arrive in order while saving, and the trackbars are shared by all individual objects.
+        if (params.prefetch_frames > 0 && obj_utils.get_is_saving() && obj_utils.get_obj_index() == 0)
+            obj_utils.prefetch_track_vals(params.prefetch_frames);
 
         // Print information.params.is_printing_info_enabled
         if (params.print_info) {
@@ -0,0 +1,269 @@
+#include "packed_memory.hpp"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+// Layout of a raw block:    [written mask][elem 0: columns...][elem 1: columns...]...
+// Layout of a sealed block: [written mask][widths (6 bits each, 5 per word)][bases][payload][padding]
+// The payload holds each column in turn, block_elems offsets of its width each.
+// The padding word lets the decoder always read two words.
+static constexpr uint32_t WIDTH_BITS = 6u;
+static constexpr uint32_t WIDTHS_PER_WORD = 5u;
+
+static inline uint32_t
+read_bits(const uint32_t *payload, size_t bit_pos, uint32_t width) {
+    size_t word = bit_pos >> 5;
+    uint32_t shift = static_cast<uint32_t>(bit_pos & 31u);
+    uint64_t pair = static_cast<uint64_t>(payload[word]) | (static_cast<uint64_t>(payload[word + 1]) << 32);
+    uint64_t mask = (1ull << width) - 1ull;
+    return static_cast<uint32_t>((pair >> shift) & mask);
+}
+
+static inline void
+write_bits(uint32_t *payload, size_t bit_pos, uint32_t width, uint32_t value) {
+    size_t word = bit_pos >> 5;
+    uint32_t shift = static_cast<uint32_t>(bit_pos & 31u);
+    uint64_t bits = static_cast<uint64_t>(value) << shift;
+    payload[word] |= static_cast<uint32_t>(bits);
+    if (shift + width > 32u)
+        payload[word + 1] |= static_cast<uint32_t>(bits >> 32);
+}
+
+PackedMemory::PackedMemory(uint32_t block_bits, size_t elem_size, uint64_t group_mask) :
+    block_index(group_mask),
+    block_bits(block_bits),
+    block_elems(1u << block_bits),
+    num_columns(static_cast<uint32_t>((elem_size + sizeof(uint32_t) - 1u) / sizeof(uint32_t))) {
+    if (block_bits > 5u)
+        throw std::invalid_argument("PackedMemory supports up to 32 elements per block.");
+    if (num_columns > MAX_COLUMNS)
+        throw std::invalid_argument("PackedMemory supports up to 64 bytes per element.");
+}
+
+void
+PackedMemory::cleanup_all_handle() {
+    std::unique_lock<std::shared_mutex> lock(mutex);
+
+    block_index.clear([](const Block &) {});
+    raw_block_ids.clear();
+}
+
+// Entries of raw_block_ids may be left behind here. They are validated before use, so they are harmless.
+size_t
+PackedMemory::cleanup_for_key1_mask(uint64_t match_bits, uint64_t mask) {
+    std::unique_lock<std::shared_mutex> lock(mutex);
+
+    size_t freed = 0u;
+    block_index.erase_key1_mask(match_bits, mask, [&](const Block &block) { freed += calc_block_bytes(block); });
+    return freed;
+}
+
+bool
+PackedMemory::has_key1(uint64_t key1) const {
+    std::shared_lock<std::shared_mutex> lock(mutex);
+
+    return block_index.has_key1(key1);
+}
+
+bool
+PackedMemory::has_key_pair(uint64_t key1, uint32_t key2) const {
+    std::shared_lock<std::shared_mutex> lock(mutex);
+
+    return block_index.find(key1, key2 >> block_bits) != nullptr;
+}
+
+size_t
+PackedMemory::erase_block(uint64_t key1, uint32_t block_id) {
+    std::unique_lock<std::shared_mutex> lock(mutex);
+
+    size_t freed = 0u;
+    block_index.erase(key1, block_id, [&](const Block &block) { freed += calc_block_bytes(block); });
+    return freed;
+}
+
+ptrdiff_t
+PackedMemory::write_bytes(uint64_t key1, uint32_t key2, const void *src, size_t size) {
+    if (size > num_columns * sizeof(uint32_t))
+        throw std::invalid_argument("The element is larger than the packed element size.");
+
+    std::unique_lock<std::shared_mutex> lock(mutex);
+
+    uint32_t block_id = key2 >> block_bits;
+    uint32_t index = key2 & (block_elems - 1u);
+    if (block_id > BlockIndex<Block>::MAX_BLOCK_ID)
+        return 0;
+
+    ptrdiff_t delta = 0;
+    Block *block = block_index.find(key1, block_id);
+    if (!block || !block->is_raw) {
+        // Only one block per key1 is kept raw.
+        delta += seal_raw_block(key1);
+
+        block = block_index.find(key1, block_id);
+        if (block) {
+            delta += unseal_block(*block);
+        } else {
+            Block raw = make_raw_block();
+            delta += static_cast<ptrdiff_t>(calc_block_bytes(raw));
+            block_index.insert(key1, block_id, std::move(raw));
+            block = block_index.find(key1, block_id);
+        }
+
+        raw_block_ids[key1] = block_id;
+    }
+
+    uint32_t *row = block->words.get() + 1u + static_cast<size_t>(index) * num_columns;
+    std::memcpy(row, src, size);
+    block->words[0] |= 1u << index;
+    return delta;
+}
+
+bool
+PackedMemory::read_bytes(uint64_t key1, uint32_t key2, void *dst, size_t size) const {
+    if (size > num_columns * sizeof(uint32_t))
+        return false;
+
+    std::shared_lock<std::shared_mutex> lock(mutex);
+
+    const Block *block = block_index.find(key1, key2 >> block_bits);
+    if (!block)
+        return false;
+
+    // Unwritten elements read back as zero, like the other backends.
+    uint32_t index = key2 & (block_elems - 1u);
+    if (block->is_raw) {
+        std::memcpy(dst, block->words.get() + 1u + static_cast<size_t>(index) * num_columns, size);
+    } else {
+        std::array<uint32_t, MAX_COLUMNS> row;
+        decode_elem(*block, index, row.data());
+        std::memcpy(dst, row.data(), size);
+    }
+
+    return true;
+}
+
+PackedMemory::Block
+PackedMemory::make_raw_block() const {
+    Block raw;
+    raw.num_words = 1u + block_elems * num_columns;
+    raw.words = std::make_unique<uint32_t[]>(raw.num_words);  // Zero filled.
+    raw.is_raw = true;
+    return raw;
+}
+
+ptrdiff_t
+PackedMemory::seal_raw_block(uint64_t key1) {
+    const uint32_t *raw_block_id = raw_block_ids.find(key1);
+    if (!raw_block_id)
+        return 0;
+
+    Block *block = block_index.find(key1, *raw_block_id);
+    raw_block_ids.erase(key1);
+    if (!block || !block->is_raw)
+        return 0;
+
+    ptrdiff_t before = static_cast<ptrdiff_t>(calc_block_bytes(*block));
+    *block = encode(*block);
+    return static_cast<ptrdiff_t>(calc_block_bytes(*block)) - before;
+}
+
+ptrdiff_t
+PackedMemory::unseal_block(Block &block) const {
+    ptrdiff_t before = static_cast<ptrdiff_t>(calc_block_bytes(block));
+
+    Block raw = make_raw_block();
+    raw.words[0] = block.words[0];
+    for (uint32_t i = 0; i < block_elems; i++) {
+        decode_elem(block, i, raw.words.get() + 1u + static_cast<size_t>(i) * num_columns);
+    }
+
+    block = std::move(raw);
+    return static_cast<ptrdiff_t>(calc_block_bytes(block)) - before;
+}
+
+PackedMemory::Block
+PackedMemory::encode(const Block &raw) const {
+    const uint32_t written_mask = raw.words[0];
+    const uint32_t num_width_words = (num_columns + WIDTHS_PER_WORD - 1u) / WIDTHS_PER_WORD;
+    auto get_raw = [&](uint32_t i, uint32_t c) { return raw.words[1u + static_cast<size_t>(i) * num_columns + c]; };
+
+    // Frame of reference of each column over the written elements.
+    std::vector<uint32_t> bases(num_columns, 0u), widths(num_columns, 0u);
+    size_t payload_bits = 0u;
+    for (uint32_t c = 0; c < num_columns; c++) {
+        int32_t min_val = INT32_MAX, max_val = INT32_MIN;
+        for (uint32_t i = 0; i < block_elems; i++) {
+            if (!(written_mask & (1u << i)))
+                continue;
+
+            int32_t val = static_cast<int32_t>(get_raw(i, c));
+            min_val = std::min(min_val, val);
+            max_val = std::max(max_val, val);
+        }
+
+        if (min_val > max_val)
+            continue;  // Nothing is written.
+
+        bases[c] = static_cast<uint32_t>(min_val);
+        widths[c] = static_cast<uint32_t>(std::bit_width(static_cast<uint32_t>(max_val) - bases[c]));
+        payload_bits += static_cast<size_t>(widths[c]) * block_elems;
+    }
+
+    Block sealed;
+    sealed.num_words = static_cast<uint32_t>(1u + num_width_words + num_columns + (payload_bits + 31u) / 32u + 1u);
+    sealed.words = std::make_unique<uint32_t[]>(sealed.num_words);
+    sealed.is_raw = false;
+
+    uint32_t *dst = sealed.words.get();
+    dst[0] = written_mask;
+    for (uint32_t c = 0; c < num_columns; c++) {
+        dst[1u + c / WIDTHS_PER_WORD] |= widths[c] << (c % WIDTHS_PER_WORD * WIDTH_BITS);
+        dst[1u + num_width_words + c] = bases[c];
+    }
+
+    uint32_t *payload = dst + 1u + num_width_words + num_columns;
+    size_t bit_pos = 0u;
+    for (uint32_t c = 0; c < num_columns; c++) {
+        if (widths[c] == 0u)
+            continue;
+
+        for (uint32_t i = 0; i < block_elems; i++) {
+            if (written_mask & (1u << i))
+                write_bits(payload, bit_pos + static_cast<size_t>(i) * widths[c], widths[c], get_raw(i, c) - bases[c]);
+        }
+
+        bit_pos += static_cast<size_t>(widths[c]) * block_elems;
+    }
+
+    return sealed;
+}
+
+void
+PackedMemory::decode_elem(const Block &sealed, uint32_t index, uint32_t *dst) const {
+    const uint32_t *src = sealed.words.get();
+    if (!(src[0] & (1u << index))) {
+        std::fill(dst, dst + num_columns, 0u);
+        return;
+    }
+
+    const uint32_t num_width_words = (num_columns + WIDTHS_PER_WORD - 1u) / WIDTHS_PER_WORD;
+    const uint32_t *bases = src + 1u + num_width_words;
+    const uint32_t *payload = bases + num_columns;
+
+    size_t bit_pos = 0u;
+    for (uint32_t c = 0; c < num_columns; c++) {
+        uint32_t width = (src[1u + c / WIDTHS_PER_WORD] >> (c % WIDTHS_PER_WORD * WIDTH_BITS)) & 0x3Fu;
+        uint32_t offset = width == 0u ? 0u : read_bits(payload, bit_pos + static_cast<size_t>(index) * width, width);
+        dst[c] = bases[c] + offset;
+        bit_pos += static_cast<size_t>(width) * block_elems;
+    }
+}
+
+size_t
+PackedMemory::calc_block_bytes(const Block &block) {
+    return sizeof(Block) + static_cast<size_t>(block.num_words) * sizeof(uint32_t);
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <type_traits>
+
+#include "flat_index.hpp"
+
+// Compressed in-process storage with the same interface as ArenaMemory.
+// An element is seen as a row of 32-bit columns. The block being written stays raw, and it is sealed when the writer of
+// the same key1 moves to another block. A sealed block stores each column as a base value and bit-packed offsets from
+// it (frame of reference), so a single element is still decoded in O(1).
+// Slowly changing or constant values, which are typical for geometry, need only a few bits per frame.
+// Sizes are reported in bytes, because they depend on the data.
+class PackedMemory {
+public:
+    static constexpr uint32_t MAX_COLUMNS = 16u;  // A sealed element is decoded on the stack.
+
+    PackedMemory(uint32_t block_bits, size_t elem_size, uint64_t group_mask = 0u);
+    ~PackedMemory() = default;
+
+    PackedMemory(const PackedMemory &) = delete;
+    PackedMemory &operator=(const PackedMemory &) = delete;
+
+    void cleanup_all_handle();
+    size_t cleanup_for_key1_mask(uint64_t match_bits, uint64_t mask);  // Returns the freed bytes.
+    bool has_key1(uint64_t key1) const;
+    bool has_key_pair(uint64_t key1, uint32_t key2) const;
+    size_t erase_block(uint64_t key1, uint32_t block_id);  // Returns the freed bytes.
+
+    // Returns the change of the used bytes.
+    template <typename T>
+    ptrdiff_t write(uint64_t key1, uint32_t key2, const T &val) {
+        static_assert(std::is_trivially_copyable_v<T>, "PackedMemory can only store trivially copyable types.");
+        static_assert(sizeof(T) % sizeof(uint32_t) == 0, "PackedMemory stores 32-bit columns.");
+        return write_bytes(key1, key2, &val, sizeof(T));
+    }
+
+    template <typename T>
+    bool read(uint64_t key1, uint32_t key2, T &val) const {
+        static_assert(std::is_trivially_copyable_v<T>, "PackedMemory can only store trivially copyable types.");
+        static_assert(sizeof(T) % sizeof(uint32_t) == 0, "PackedMemory stores 32-bit columns.");
+        return read_bytes(key1, key2, &val, sizeof(T));
+    }
+
+private:
+    struct Block {
+        std::unique_ptr<uint32_t[]> words;
+        uint32_t num_words = 0;
+        bool is_raw = false;
+    };
+
+    // Readers only take a shared lock, so concurrent reads do not serialize.
+    mutable std::shared_mutex mutex;
+
+    BlockIndex<Block> block_index;
+    FlatIndex<uint32_t> raw_block_ids;  // key1 -> id of the raw block.
+    uint32_t block_bits;
+    uint32_t block_elems;
+    uint32_t num_columns;
+
+    ptrdiff_t write_bytes(uint64_t key1, uint32_t key2, const void *src, size_t size);
+    bool read_bytes(uint64_t key1, uint32_t key2, void *dst, size_t size) const;
+
+    Block make_raw_block() const;
+    ptrdiff_t seal_raw_block(uint64_t key1);
+    ptrdiff_t unseal_block(Block &block) const;
+    Block encode(const Block &raw) const;
+    void decode_elem(const Block &sealed, uint32_t index, uint32_t *dst) const;
+    static size_t calc_block_bytes(const Block &block);
+};
@@ -0,0 +1,170 @@
+#include "shader_cache.hpp"
+
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <system_error>
+#define NOMINMAX
+#include <Windows.h>
+
+#include "embedded_shaders.hpp"
+#include "utils.hpp"
+
+void
+ShaderCache::begin_frame(int32_t frame_num) {
+    curr_frame = frame_num;
+}
+
+// An override file may also have been added or removed.
+bool
+ShaderCache::poll_modified(ShaderId id) {
+    Entry &entry = entries[static_cast<size_t>(id)];
+    if (!entry.is_resolved)
+        return false;
+
+    uint64_t tick = ::GetTickCount64();
+    if (entry.checked_frame == curr_frame && tick - entry.checked_tick < CHECK_INTERVAL_MS)
+        return false;
+
+    entry.checked_frame = curr_frame;
+    entry.checked_tick = tick;
+
+    std::string source_path = find_override(entry.shader_dir, id);
+    if (source_path == entry.source_path && get_write_time(source_path) == entry.write_time)
+        return false;
+
+    load(entry, entry.shader_dir, id);
+    return true;
+}
+
+const std::string &
+ShaderCache::get_path(const std::filesystem::path &shader_dir, ShaderId id, uint32_t variant) {
+    Entry &entry = entries[static_cast<size_t>(id)];
+    if (!entry.is_resolved || entry.shader_dir != shader_dir)
+        load(entry, shader_dir, id);
+
+    std::string &path = entry.variant_paths[variant % NUM_VARIANTS];
+    if (path.empty()) {
+        std::string_view name = id == ShaderId::Doubling ? "MotionBlur_K_Doubling" : "MotionBlur_K";
+        path = write_source(name, make_variant_source(entry.source, variant));
+    }
+
+    return path;
+}
+
+void
+ShaderCache::load(Entry &entry, const std::filesystem::path &shader_dir, ShaderId id) {
+    entry.source_path = find_override(shader_dir, id);
+    if (entry.source_path.empty()) {
+        entry.source = id == ShaderId::Doubling ? EMBEDDED_OMB_DOUBLING_SHADER : EMBEDDED_OMB_SHADER;
+    } else {
+        std::ifstream file(entry.source_path, std::ios::binary);
+        entry.source.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        if (!file)
+            throw std::runtime_error("Failed to read the shader file: " + entry.source_path);
+    }
+
+    entry.shader_dir = shader_dir;
+    entry.write_time = get_write_time(entry.source_path);
+    entry.variant_paths.fill(std::string());
+    entry.is_resolved = true;
+}
+
+std::string
+ShaderCache::find_override(const std::filesystem::path &shader_dir, ShaderId id) {
+    std::filesystem::path override_path = get_self_dir() / shader_dir.relative_path();
+    override_path /= id == ShaderId::Doubling ? "MotionBlur_K_Doubling.frag" : "MotionBlur_K.frag";
+
+    std::error_code ec;
+    return std::filesystem::is_regular_file(override_path, ec) ? override_path.string() : std::string();
+}
+
+// #line keeps the line numbers of compile errors those of the source.
+std::string
+ShaderCache::make_variant_source(std::string_view source, uint32_t variant) {
+    if (variant == 0u)
+        return std::string(source);
+
+    static constexpr std::array<std::string_view, 7> DEFINES = {"OMB_TWO_SEGMENTS", "OMB_TRANSLATION", "OMB_BLEND",
+                                                                "OMB_ADAPTIVE",     "OMB_PREFILTER",   "OMB_JITTER",
+                                                                "OMB_RECONSTRUCT"};
+
+    size_t insert_pos = 0u;
+    size_t line = 1u;
+    size_t version_pos = source.find("#version");
+    if (version_pos != std::string_view::npos) {
+        size_t line_end = source.find('\n', version_pos);
+        insert_pos = line_end == std::string_view::npos ? source.size() : line_end + 1u;
+        for (size_t i = 0; i < insert_pos; i++)
+            line += source[i] == '\n' ? 1u : 0u;
+    }
+
+    std::string result(source.substr(0, insert_pos));
+    if (!result.empty() && result.back() != '\n')
+        result += '\n';
+
+    for (size_t i = 0; i < DEFINES.size(); i++) {
+        if (variant & (1u << i)) {
+            result += "#define ";
+            result += DEFINES[i];
+            result += '\n';
+        }
+    }
+
+    result += "#line " + std::to_string(line) + "\n";
+    result += source.substr(insert_pos);
+    return result;
+}
+
+// Other processes may write the same file at the same time, so it is written to a unique name and then renamed.
+std::string
+ShaderCache::write_source(std::string_view name, std::string_view source) {
+    char hash_str[17];
+    std::snprintf(hash_str, sizeof(hash_str), "%016llx", static_cast<unsigned long long>(calc_hash(source)));
+
+    std::error_code ec;
+    std::filesystem::path dir = std::filesystem::temp_directory_path(ec) / "MotionBlur_K";
+    std::filesystem::create_directories(dir, ec);
+
+    std::filesystem::path path = dir / (std::string(name) + "_" + hash_str + ".frag");
+    if (std::filesystem::is_regular_file(path, ec))
+        return path.string();
+
+    std::filesystem::path temp_path = path;
+    temp_path += "." + std::to_string(::GetCurrentProcessId()) + ".tmp";
+    {
+        std::ofstream file(temp_path, std::ios::binary | std::ios::trunc);
+        file.write(source.data(), static_cast<std::streamsize>(source.size()));
+        if (!file)
+            throw std::runtime_error("Failed to write the shader file: " + temp_path.string());
+    }
+
+    std::filesystem::rename(temp_path, path, ec);
+    if (ec) {
+        std::filesystem::remove(temp_path, ec);
+        if (!std::filesystem::is_regular_file(path, ec))
+            throw std::runtime_error("Failed to write the shader file: " + path.string());
+    }
+
+    return path.string();
+}
+
+std::filesystem::file_time_type
+ShaderCache::get_write_time(const std::string &path) {
+    std::error_code ec;
+    std::filesystem::file_time_type write_time = std::filesystem::last_write_time(path, ec);
+    return ec ? std::filesystem::file_time_type{} : write_time;
+}
+
+// FNV-1a
+uint64_t
+ShaderCache::calc_hash(std::string_view source) {
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (unsigned char c : source) {
+        hash ^= c;
+        hash *= 0x100000001b3ull;
+    }
+
+    return hash;
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <string_view>
+
+enum class ShaderId : int {
+    Standard,  // MotionBlur_K.frag
+    Doubling   // MotionBlur_K_Doubling.frag
+};
+
+// Paths of the fragment shaders handed to GLShaderKit.
+// The shaders are embedded in the DLL, and a file of the same name in the shader folder overrides the embedded one.
+// The standard shader has compile-time variants. A variant is the source with a #define per flag inserted after the
+// #version line, so one source serves all of them.
+// Each variant is written once to the temporary folder under a name containing the hash of its source.
+// GLShaderKit keeps the compiled program per path, so each variant is compiled once, and an edited source gets new
+// paths by itself.
+// The source is resolved once per shader folder, so there is no filesystem access per object.
+// In watch mode, the folder and the modification time are checked again at most once per frame (and per
+// CHECK_INTERVAL_MS while the same frame is rendered again), and the source is read again only when its file changed.
+// Only the main thread may use it.
+class ShaderCache {
+public:
+    // Variant flags of ShaderId::Standard.
+    static constexpr uint32_t VARIANT_TWO_SEGMENTS = 1u << 0;  // OMB_TWO_SEGMENTS: seg2 has samples.
+    static constexpr uint32_t VARIANT_TRANSLATION = 1u << 1;   // OMB_TRANSLATION: the chains are pure translations.
+    static constexpr uint32_t VARIANT_BLEND = 1u << 2;         // OMB_BLEND: the original image is blended.
+    static constexpr uint32_t VARIANT_ADAPTIVE = 1u << 3;      // OMB_ADAPTIVE: per-pixel sample counts.
+    static constexpr uint32_t VARIANT_PREFILTER = 1u << 4;     // OMB_PREFILTER: the chains sample prefiltered sources.
+    static constexpr uint32_t VARIANT_JITTER = 1u << 5;        // OMB_JITTER: per-pixel offsets of the samples.
+    static constexpr uint32_t VARIANT_RECONSTRUCT = 1u << 6;   // OMB_RECONSTRUCT: taps along the velocity.
+    static constexpr size_t NUM_VARIANTS = 128u;
+
+    void begin_frame(int32_t frame_num);
+    bool poll_modified(ShaderId id);  // Call before get_path. Returns true if the source changed.
+    const std::string &get_path(const std::filesystem::path &shader_dir, ShaderId id, uint32_t variant = 0u);
+
+private:
+    static constexpr uint64_t CHECK_INTERVAL_MS = 200u;
+
+    struct Entry {
+        bool is_resolved = false;
+        std::filesystem::path shader_dir;
+        std::string source_path;  // Empty: embedded.
+        std::string source;
+        std::filesystem::file_time_type write_time{};
+        std::array<std::string, NUM_VARIANTS> variant_paths;  // Empty: not written yet.
+        int32_t checked_frame = -1;
+        uint64_t checked_tick = 0u;
+    };
+
+    std::array<Entry, 2> entries;
+    int32_t curr_frame = -1;
+
+    static void load(Entry &entry, const std::filesystem::path &shader_dir, ShaderId id);
+    static std::string find_override(const std::filesystem::path &shader_dir, ShaderId id);
+    static std::string make_variant_source(std::string_view source, uint32_t variant);
+    static std::string write_source(std::string_view name, std::string_view source);
+    static uint64_t calc_hash(std::string_view source);
+    static std::filesystem::file_time_type get_write_time(const std::string &path);
+};
@@ -2,35 +2,40 @@
 
 #include <cstdint>
 #include <cstring>
-#include <map>
 #include <mutex>
-#include <unordered_map>
+#include <shared_mutex>
 #define NOMINMAX
 #define WIN32_LEAN_AND_MEAN
 #include <Windows.h>
 
+#include "flat_index.hpp"
+
 class SharedMemory {
 public:
-    SharedMemory(uint32_t block_bits = 0u);
+    SharedMemory(uint32_t block_bits = 0u, uint64_t group_mask = 0u);
     ~SharedMemory();
 
     SharedMemory(const SharedMemory &) = delete;
     SharedMemory &operator=(const SharedMemory &) = delete;
 
     void cleanup_all_handle();
-    void cleanup_for_key1_mask(uint32_t match_bits, uint32_t mask);
-    bool has_key1(uint32_t key1) const;
-    bool has_key_pair(uint32_t key1, uint32_t key2) const;
+    size_t cleanup_for_key1_mask(uint64_t match_bits, uint64_t mask);  // Returns the number of erased blocks.
+    bool has_key1(uint64_t key1) const;
+    bool has_key_pair(uint64_t key1, uint32_t key2) const;
+    bool erase_block(uint64_t key1, uint32_t block_id);
 
+    // Returns true if a new block was created.
     template <typename T>
-    void write(uint32_t key1, uint32_t key2, const T &val) {
-        std::lock_guard<std::mutex> lock(mutex);
+    bool write(uint64_t key1, uint32_t key2, const T &val) {
+        std::unique_lock<std::shared_mutex> lock(mutex);
 
         const size_t size = sizeof(T);
         const size_t total_size = size << block_bits;
 
         uint32_t block_id, block_offset;
         calc_block_pos(key2, block_id, block_offset);
+        if (block_id > BlockIndex<HANDLE>::MAX_BLOCK_ID)
+            return false;
 
         HANDLE old_handle = get_shared_mem_handle(key1, block_id);
         HANDLE new_handle = nullptr;
@@ -39,7 +44,7 @@ public:
         if (old_handle == nullptr) {
             new_handle = ::CreateFileMapping(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, 0, total_size, nullptr); // 0 padding
             if (new_handle == nullptr)
-                return;
+                return false;
 
             is_newly_created = true;
         } else {
@@ -51,7 +56,7 @@ public:
             if (is_newly_created)
                 CloseHandle(new_handle);
 
-            return;
+            return false;
         }
 
         std::memcpy(ptr + block_offset, &val, size);
@@ -59,11 +64,13 @@ public:
 
         if (is_newly_created)
             set_shared_mem_handle(key1, block_id, new_handle);
+
+        return is_newly_created;
     }
 
     template <typename T>
-    bool read(uint32_t key1, uint32_t key2, T &val) const {
-        std::lock_guard<std::mutex> lock(mutex);
+    bool read(uint64_t key1, uint32_t key2, T &val) const {
+        std::shared_lock<std::shared_mutex> lock(mutex);
 
         const size_t size = sizeof(T);
         const size_t total_size = size << block_bits;
@@ -87,14 +94,15 @@ public:
     }
 
 private:
-    mutable std::mutex mutex;
+    // Readers only take a shared lock, so concurrent reads do not serialize.
+    mutable std::shared_mutex mutex;
 
-    std::unordered_map<uint32_t, std::map<uint32_t, HANDLE>> handle_map;
+    BlockIndex<HANDLE> handle_index;
     uint32_t block_bits;
 
     void calc_block_pos(uint32_t key, uint32_t &block_id, uint32_t &block_offset) const;
-    HANDLE get_shared_mem_handle(uint32_t key1, uint32_t block_id) const;
-    void set_shared_mem_handle(uint32_t key1, uint32_t block_id, HANDLE handle);
+    HANDLE get_shared_mem_handle(uint64_t key1, uint32_t block_id) const;
+    void set_shared_mem_handle(uint64_t key1, uint32_t block_id, HANDLE handle);
     void cleanup_all_handle_impl() noexcept;
 };
 
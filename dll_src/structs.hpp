@@ -15,15 +15,16 @@ struct Image {
 // obj.ox etc.
 struct Geometry {
     bool is_valid;
+    uint8_t padding[3];  // Always zero, so that the packed storage sees the same bits in every frame.
     int32_t ox, oy;
     int32_t cx, cy;  // For the future.
     int32_t zoom;
     int32_t rz;
 
-    constexpr Geometry() : is_valid(true), ox(0), oy(0), cx(0), cy(0), zoom(0), rz(0) {}
+    constexpr Geometry() : is_valid(true), padding(), ox(0), oy(0), cx(0), cy(0), zoom(0), rz(0) {}
 
     constexpr Geometry(int32_t ox_, int32_t oy_, int32_t cx_, int32_t cy_, int32_t zoom_, int32_t rz_) :
-        is_valid(true), ox(ox_), oy(oy_), cx(cx_), cy(cy_), zoom(zoom_), rz(rz_) {}
+        is_valid(true), padding(), ox(ox_), oy(oy_), cx(cx_), cy(cy_), zoom(zoom_), rz(rz_) {}
 };
 
 // A structure to store data for each segment.
@@ -45,6 +46,24 @@ struct Corner {
     Corner() : location(0.0f, 0.0f), upper_left(0, 0), lower_right(0, 0) {}
 };
 
+// How the samples of a chain are accumulated.
+enum class AccumMode : int {
+    Standard,    // One fetch per sample.
+    Doubling,    // log2(samples) passes of recursive doubling.
+    Adaptive,    // One fetch per sample, but each pixel takes only the samples its own step length needs.
+    Sliding,     // Prefix sums along the motion. The cost per pixel is constant, but only for translations and pure
+                 // rotations or zooms around the pivot.
+    Reconstruct  // A few taps along the velocity of each pixel. The cost is bounded, but only for small rotations.
+};
+
+// Resolution the blur is rendered at. The result is upsampled to the image.
+enum class Downscale : int {
+    Auto,    // Half or Quarter for large images with long blurs.
+    Off,     // Full resolution.
+    Half,    // 1/2
+    Quarter  // 1/4
+};
+
 // Blur step.
 struct Steps {
     Vec2<float> location;
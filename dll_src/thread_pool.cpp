@@ -0,0 +1,127 @@
+#include "thread_pool.hpp"
+
+#include <algorithm>
+
+static thread_local unsigned int curr_thread_index = 0u;
+
+ThreadPool::ThreadPool(unsigned int num_workers) :
+    job(nullptr), job_count(0), next_index(0), active_workers(0), generation(0), is_stopping(false) {
+    workers.reserve(num_workers);
+    for (unsigned int i = 0; i < num_workers; i++) {
+        workers.emplace_back([this, i]() { worker_loop(i + 1u); });
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        is_stopping = true;
+    }
+
+    job_cv.notify_all();
+    for (auto &worker : workers) {
+        if (worker.joinable())
+            worker.join();
+    }
+}
+
+unsigned int
+ThreadPool::get_concurrency() const {
+    return static_cast<unsigned int>(workers.size()) + 1u;
+}
+
+unsigned int
+ThreadPool::get_thread_index() {
+    return curr_thread_index;
+}
+
+void
+ThreadPool::parallel_for(int count, const std::function<void(int)> &func) {
+    if (count <= 0)
+        return;
+
+    // Not worth waking the workers.
+    if (count == 1 || workers.empty()) {
+        for (int i = 0; i < count; i++) func(i);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        job = &func;
+        job_count = count;
+        next_index.store(0, std::memory_order_relaxed);
+        active_workers = static_cast<int>(workers.size());
+        generation++;
+    }
+
+    job_cv.notify_all();
+    run_job(func, count);
+
+    std::exception_ptr error;
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        done_cv.wait(lock, [this]() { return active_workers == 0; });
+        job = nullptr;
+        std::swap(error, job_error);
+    }
+
+    if (error)
+        std::rethrow_exception(error);
+}
+
+void
+ThreadPool::worker_loop(unsigned int thread_index) {
+    curr_thread_index = thread_index;
+    uint64_t seen_generation = 0;
+
+    while (true) {
+        const std::function<void(int)> *func = nullptr;
+        int count = 0;
+
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            job_cv.wait(lock, [&]() { return is_stopping || generation != seen_generation; });
+            if (is_stopping)
+                return;
+
+            seen_generation = generation;
+            func = job;
+            count = job_count;
+        }
+
+        run_job(*func, count);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            active_workers--;
+        }
+
+        done_cv.notify_one();
+    }
+}
+
+// An exception must not leave a worker, which would terminate the process, nor the caller before the workers are done
+// with func. It is kept for parallel_for() to rethrow.
+void
+ThreadPool::run_job(const std::function<void(int)> &func, int count) {
+    try {
+        for (int i = next_index.fetch_add(1, std::memory_order_relaxed); i < count;
+             i = next_index.fetch_add(1, std::memory_order_relaxed)) {
+            func(i);
+        }
+    } catch (...) {
+        next_index.store(count, std::memory_order_relaxed);
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!job_error)
+            job_error = std::current_exception();
+    }
+}
+
+ThreadPool &
+get_thread_pool() {
+    // Intentionally leaked.
+    // Joining the workers from a static destructor would run under the loader lock when the DLL is unloaded.
+    static ThreadPool *pool = new ThreadPool(std::max(std::thread::hardware_concurrency(), 1u) - 1u);
+    return *pool;
+}
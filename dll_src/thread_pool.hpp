@@ -0,0 +1,52 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A small fixed-size worker pool.
+// The calling thread always takes part in the work, so a pool with N workers runs N + 1 jobs at once.
+class ThreadPool {
+public:
+    explicit ThreadPool(unsigned int num_workers);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    unsigned int get_concurrency() const;
+
+    // Index of the calling thread in [0, get_concurrency()): 0 for the thread calling parallel_for, and 1 to N for the
+    // workers. Scratch memory of a job can be kept per thread with it.
+    static unsigned int get_thread_index();
+
+    // Call func(i) for every i in [0, count) and return after all calls have finished.
+    // If a call throws, the remaining indices are skipped and the first exception is rethrown once the workers are done.
+    void parallel_for(int count, const std::function<void(int)> &func);
+
+private:
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable job_cv;
+    std::condition_variable done_cv;
+
+    const std::function<void(int)> *job;
+    int job_count;
+    std::atomic<int> next_index;
+    std::exception_ptr job_error;  // First exception thrown by the job.
+    int active_workers;
+    uint64_t generation;
+    bool is_stopping;
+
+    void worker_loop(unsigned int thread_index);
+    void run_job(const std::function<void(int)> &func, int count);
+};
+
+// Shared pool sized to the machine.
+ThreadPool &
+get_thread_pool();
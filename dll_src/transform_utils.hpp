@@ -31,6 +31,7 @@ public:
     float get_rz(AngleUnit unit = AngleUnit::Rad) const;
     Vec2<float> get_center() const;
 
+    void set_center(const Vec2<float> &center);
     void apply_geometry();
     void apply_geometry(const Geometry &geo);
 
@@ -113,6 +114,13 @@ Transform::get_center() const {
     return Vec2<float>(cx, cy);
 }
 
+// Transform Setters
+inline void
+Transform::set_center(const Vec2<float> &center) {
+    cx = center.get_x();
+    cy = center.get_y();
+}
+
 // Displacements Getters
 inline Vec2<float>
 Displacements::get_location(Coords coords) const {
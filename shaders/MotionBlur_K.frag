@@ -5,53 +5,195 @@ in vec2 TexCoord;
 layout(location = 0) out vec4 FragColor;
 
 uniform sampler2D texture0;
-uniform vec2 resolution;
-uniform vec2 pivot;
-uniform int is_orig_img_visible;
-uniform ivec2 samples;
 
-uniform vec2 step_pos_offset;
-uniform float step_scale_offset;
-uniform mat2 step_rot_mat_offset;
+#ifdef OMB_PREFILTER
+uniform sampler2D texture1;  // Source of seg1.
+uniform sampler2D texture2;  // Source of seg2.
+#define SEG1_SOURCE texture1
+#define SEG2_SOURCE texture2
+#else
+#define SEG1_SOURCE texture0
+#define SEG2_SOURCE texture0
+#endif
 
-uniform vec2 step_pos_seg1;
-uniform float step_scale_seg1;
-uniform mat2 step_rot_mat_seg1;
+// Compile-time variants, defined by the plugin from the plan.
+// OMB_TWO_SEGMENTS: seg2 has samples.
+// OMB_TRANSLATION: the step matrices of the chains are identities.
+// OMB_BLEND: the original image is blended.
+// OMB_ADAPTIVE: each pixel takes only the samples its own step length needs. Never with OMB_TRANSLATION.
+// OMB_PREFILTER: the chains sample the sources prefiltered along their steps. Only with the standard accumulation.
+// OMB_JITTER: each pixel moves its samples by a fraction of a step. Never with the doubling shader.
+// OMB_RECONSTRUCT: each chain is a few taps along the straight line to its end. Never with OMB_TRANSLATION or
+//                  OMB_ADAPTIVE.
 
-uniform vec2 step_pos_seg2;
-uniform float step_scale_seg2;
-uniform mat2 step_rot_mat_seg2;
+// Parameter block, uploaded at once.
+// params: (resolution, pivot), (offset pos, seg1 pos), (seg2 pos, region origin),
+//         (seg1 rz_rad, seg1 log_scale, seg2 rz_rad, seg2 log_scale)
+// step_mats: the offset, seg1 and seg2 matrices as column-major mat2, (tile size, tile origin)
+// The textures hold a region of the image, and resolution and pivot are those of the region. The output is a tile of
+// it: the pixel at TexCoord is TexCoord * tile size + tile origin in the region, and the region origin is added for the
+// pixel in the image. An untiled image is a single region and tile.
+// counts: (seg1 samples, seg2 samples)
+// The offset maps uv to offset_mat * uv + offset_pos. A chain step maps (uv, pos) to (M * (uv - pos), M * pos).
+uniform mat4 params;
+uniform mat4 step_mats;
+uniform ivec2 counts;
 
+#ifdef OMB_ADAPTIVE
+// Columns: seg1, seg2 as (k_radius, k_const, rz_rad, log_scale).
+// A pixel whose chain starts at the distance r from the pivot takes k = ceil(k_radius * r + k_const) samples, spaced
+// n / k steps apart and weighted n / k. The step matrix of the stride is M^(n / k).
+uniform mat4 adaptive;
+#endif
 
-// Clamp the texture coordinates to avoid sampling outside the texture bounds.
+#ifdef OMB_RECONSTRUCT
+// Columns: the seg1 and seg2 velocity matrices as mat2, (seg1 velocity pos, seg2 velocity pos),
+//          (tap limit, tile size, unused, unused)
+// A chain starting at uv ends at uv + W(uv), W(uv) = mat * uv + pos. A tile takes one tap per pixel its fastest pixel
+// moves, up to the tap limit. |W| is convex, so the fastest pixel is at a corner of the tile.
+uniform mat4 reconstruct;
+#endif
+
+vec2 resolution;
+vec2 pivot;
+
+// M^h = R(-rz_rad * h) / scale^h of a step matrix M = R(-rz_rad) / scale.
+mat2
+step_mat_pow(in float rz_rad, in float log_scale, in float h) {
+    float inv_scale = exp(-h * log_scale);
+    float c = cos(h * rz_rad) * inv_scale;
+    float s = sin(h * rz_rad) * inv_scale;
+    return mat2(c, -s, s, c);
+}
+
+#ifdef OMB_JITTER
+// Samples sit at t = i - jitter steps instead of t = i, with jitter in [-0.5, 0.5), so each stays within half a step of
+// its regular position.
+// The chain is moved back by jitter steps before the first sample and forward again after the last one, so the next
+// segment starts where it does without jitter.
+float jitter;
+
+// Interleaved gradient noise. It is the same in every frame, and neighbouring pixels get well spread offsets.
+float
+jitter_noise(in vec2 pixel) {
+    return fract(52.9829189 * fract(dot(pixel, vec2(0.06711056, 0.00583715))));
+}
+
+// Move the chain by h steps: (uv, pos) -> (M^h * (uv - h * pos), M^h * pos)
+void
+shift_chain(inout vec2 uv, inout vec2 localized_step_pos, in float rz_rad, in float log_scale, in float h) {
+    mat2 shift_mat = step_mat_pow(rz_rad, log_scale, h);
+    uv = shift_mat * (uv - h * localized_step_pos);
+    localized_step_pos = shift_mat * localized_step_pos;
+}
+#endif
+
+// Sample at the pivot-relative uv. Outside of the texture is transparent.
 vec4
-safe_texture(in sampler2D tex, in vec2 uv, in vec2 resolution) {
-    if (uv.x < 0.0 || uv.x > resolution.x || uv.y < 0.0 || uv.y > resolution.y) {
-        return vec4(0.0);
+fetch(in sampler2D tex, in vec2 uv) {
+    vec2 tex_uv = uv + pivot;
+    vec2 inside = step(vec2(0.0), tex_uv) * step(tex_uv, resolution);
+    vec4 color = texture(tex, tex_uv / resolution) * (inside.x * inside.y);
+    color.rgb *= color.a;
+    return color;
+}
+
+#ifdef OMB_RECONSTRUCT
+vec2
+velocity(in int seg, in vec2 uv) {
+    return mat2(reconstruct[seg]) * uv + (seg == 0 ? reconstruct[2].xy : reconstruct[2].zw);
+}
+
+// Taps of seg1 and seg2 for the tile of the pixel in the image.
+// A region ends at a render tile or at the edge of the image, so a tile never crosses it.
+ivec2
+calc_taps(in vec2 pixel) {
+    float tile = reconstruct[3].y;
+    vec2 origin = params[2].zw;
+    vec2 lo = floor(pixel / tile) * tile + 0.5;
+    vec2 hi = min(lo + tile - 1.0, origin + resolution - 0.5);
+    vec2 max_length = vec2(0.0);
+    for (int i = 0; i < 4; i++) {
+        vec2 corner = vec2(i % 2 == 0 ? lo.x : hi.x, i < 2 ? lo.y : hi.y);
+        vec2 uv = mat2(step_mats[0]) * (corner - origin - pivot) + params[1].xy;
+        vec2 v = velocity(0, uv);
+        max_length = max(max_length, vec2(length(v), length(velocity(1, uv + v))));
     }
-    return texture(tex, uv / resolution);
+
+    ivec2 limit = min(ivec2(int(reconstruct[3].x)), counts);
+    return min(clamp(ivec2(ceil(max_length)), ivec2(1), max(limit, ivec2(1))), limit);
 }
+#endif
 
 // Blur the texture using the given parameters.
-int
-blur(inout vec2 uv, inout vec4 color, in int samples, in vec2 step_pos, in float step_scale, in mat2 step_rot_mat) {
-    int sample_count = 0;
+#if defined(OMB_RECONSTRUCT)
+void
+blur(in sampler2D source, inout vec2 uv, inout vec4 color, in int samples, in int taps, in vec2 v) {
+    float weight = float(samples) / float(max(taps, 1));
+    for (int i = 1; i <= taps; i++) {
+#ifdef OMB_JITTER
+        // A tap past the end wraps to the start, so the taps stay on the line.
+        float t = (float(i) - jitter) / float(taps);
+        t = t > 1.0 ? t - 1.0 : t;
+#else
+        float t = float(i) / float(taps);
+#endif
+        color += fetch(source, uv + t * v) * weight;
+    }
+    uv += v;
+}
+#elif defined(OMB_TRANSLATION)
+void
+blur(in sampler2D source, inout vec2 uv, inout vec4 color, in int samples, in vec2 step_pos) {
+#ifdef OMB_JITTER
+    uv += jitter * step_pos;
+#endif
+    for (int i = 1; i <= samples; i++) {
+        uv -= step_pos;
+        color += fetch(source, uv);
+    }
+#ifdef OMB_JITTER
+    uv -= jitter * step_pos;
+#endif
+}
+#elif defined(OMB_ADAPTIVE)
+void
+blur(in sampler2D source, inout vec2 uv, inout vec4 color, in int samples, in vec2 step_pos, in vec4 chain) {
+    int count = samples <= 1 ? samples : clamp(int(ceil(chain.x * length(uv) + chain.y)), 1, samples);
+    float stride = float(samples) / float(max(count, 1));
+    mat2 step_mat = step_mat_pow(chain.z, chain.w, stride);
 
+    vec2 localized_step_pos = step_pos * stride;
+#ifdef OMB_JITTER
+    shift_chain(uv, localized_step_pos, chain.z * stride, chain.w * stride, -jitter);
+#endif
+    for (int i = 1; i <= count; i++) {
+        uv = step_mat * (uv - localized_step_pos);
+        localized_step_pos = step_mat * localized_step_pos;
+        color += fetch(source, uv) * stride;
+    }
+#ifdef OMB_JITTER
+    shift_chain(uv, localized_step_pos, chain.z * stride, chain.w * stride, jitter);
+#endif
+}
+#else
+void
+blur(in sampler2D source, inout vec2 uv, inout vec4 color, in int samples, in vec2 step_pos, in mat2 step_mat,
+     in vec2 rz_log_scale) {
     vec2 localized_step_pos = step_pos;
+#ifdef OMB_JITTER
+    shift_chain(uv, localized_step_pos, rz_log_scale.x, rz_log_scale.y, -jitter);
+#endif
     for (int i = 1; i <= samples; i++) {
-        uv -= localized_step_pos;
-        uv *= step_rot_mat / step_scale;
-
-        vec4 step_color = safe_texture(texture0, uv + pivot, resolution);
-        step_color.rgb *= step_color.a;
-        color += step_color;
-
-        sample_count++;
-        localized_step_pos *= step_rot_mat / step_scale;
+        uv = step_mat * (uv - localized_step_pos);
+        localized_step_pos = step_mat * localized_step_pos;
+        color += fetch(source, uv);
     }
-
-    return sample_count;
+#ifdef OMB_JITTER
+    shift_chain(uv, localized_step_pos, rz_log_scale.x, rz_log_scale.y, jitter);
+#endif
 }
+#endif
 
 // Guessed AviUtl's normal blend.
 vec4
@@ -73,19 +215,48 @@ blend(in vec4 color1, in vec4 color2) {
 
 void
 main() {
-    vec2 uv = TexCoord * resolution - pivot;
-    uv *= step_scale_offset;
-    uv += step_pos_offset;
-    uv = step_rot_mat_offset * uv;
-    vec4 color = safe_texture(texture0, uv + pivot, resolution);
-    color.rgb *= color.a;
+    resolution = params[0].xy;
+    pivot = params[0].zw;
 
-    int sample_count = 1;
+    vec2 pixel = TexCoord * step_mats[3].xy + step_mats[3].zw;
+    vec2 uv = pixel - pivot;
+    uv = mat2(step_mats[0]) * uv + params[1].xy;
+    vec4 color = fetch(texture0, uv);
 
-    sample_count += blur(uv, color, samples.x, step_pos_seg1, step_scale_seg1, step_rot_mat_seg1);
-    if (samples.y != 0) {
-        sample_count += blur(uv, color, samples.y, step_pos_seg2, step_scale_seg2, step_rot_mat_seg2);
-    }
+#ifdef OMB_JITTER
+    float noise = jitter_noise(floor(pixel + params[2].zw));
+    jitter = noise - 0.5;
+#endif
+
+    int sample_count = 1 + counts.x;
+#ifdef OMB_RECONSTRUCT
+    ivec2 taps = calc_taps(floor(pixel + params[2].zw) + 0.5);
+#endif
+#if defined(OMB_RECONSTRUCT)
+    blur(SEG1_SOURCE, uv, color, counts.x, taps.x, velocity(0, uv));
+#elif defined(OMB_TRANSLATION)
+    blur(SEG1_SOURCE, uv, color, counts.x, params[1].zw);
+#elif defined(OMB_ADAPTIVE)
+    blur(SEG1_SOURCE, uv, color, counts.x, params[1].zw, adaptive[0]);
+#else
+    blur(SEG1_SOURCE, uv, color, counts.x, params[1].zw, mat2(step_mats[1]), params[3].xy);
+#endif
+
+#ifdef OMB_TWO_SEGMENTS
+    sample_count += counts.y;
+#ifdef OMB_JITTER
+    jitter = fract(noise + 0.618034) - 0.5;
+#endif
+#if defined(OMB_RECONSTRUCT)
+    blur(SEG2_SOURCE, uv, color, counts.y, taps.y, velocity(1, uv));
+#elif defined(OMB_TRANSLATION)
+    blur(SEG2_SOURCE, uv, color, counts.y, params[2].xy);
+#elif defined(OMB_ADAPTIVE)
+    blur(SEG2_SOURCE, uv, color, counts.y, params[2].xy, adaptive[1]);
+#else
+    blur(SEG2_SOURCE, uv, color, counts.y, params[2].xy, mat2(step_mats[2]), params[3].zw);
+#endif
+#endif
 
     // Avoid division by zero.
     // Division by zero can occur when the sample count is small, and the blur width is large.
@@ -95,9 +266,9 @@ main() {
     color.rgb = mix(color.rgb / max(color.a, 0.0001), vec3(0.0), is_zero); // 
     color.a /= sample_count;
     color = clamp(color, 0.0, 1.0);
-    // Blend the original image with the blurred image if is_orig_img_visible is true.
-    if (bool(is_orig_img_visible)) {
-        color = blend(color, texture(texture0, TexCoord));
-    }
+#ifdef OMB_BLEND
+    // Blend the original image with the blurred image.
+    color = blend(color, texture(texture0, pixel / resolution));
+#endif
     FragColor = color;
 }
\ No newline at end of file
@@ -0,0 +1,103 @@
+#version 460 core
+
+in vec2 TexCoord;
+
+layout(location = 0) out vec4 FragColor;
+
+// Recursive doubling of MotionBlur_K.frag.
+// pass_type 0: P_1(v) = (I(v) + I(A v)) / 2 from the (straight alpha) source image.
+// pass_type 1: P_(m+1)(v) = (P_m(v) + P_m(A^(2^m) v)) / 2 on the premultiplied result of the previous pass.
+// pass_type 2: Composite I(offset(v)) + n1 * P1(A1 offset(v)) + n2 * P2(B offset(v)).
+
+uniform sampler2D texture0;  // Source image or previous pass.
+uniform sampler2D texture1;  // Averaged seg1 chain.
+uniform sampler2D texture2;  // Averaged seg2 chain.
+uniform vec2 resolution;
+uniform vec2 pivot;
+uniform int pass_type;
+uniform int is_orig_img_visible;
+uniform ivec2 samples;
+
+// Affine maps. mat = (a, b, c, d) row-major, pos = (tx, ty).
+uniform vec4 map_mat;
+uniform vec2 map_pos;
+uniform vec4 offset_mat;
+uniform vec2 offset_pos;
+uniform vec4 seg1_mat;
+uniform vec2 seg1_pos;
+uniform vec4 seg2_mat;
+uniform vec2 seg2_pos;
+
+
+vec2
+apply_affine(in vec4 mat, in vec2 pos, in vec2 v) {
+    return vec2(mat.x * v.x + mat.y * v.y, mat.z * v.x + mat.w * v.y) + pos;
+}
+
+// Clamp the texture coordinates to avoid sampling outside the texture bounds.
+vec4
+safe_texture(in sampler2D tex, in vec2 uv, in vec2 resolution) {
+    if (uv.x < 0.0 || uv.x > resolution.x || uv.y < 0.0 || uv.y > resolution.y) {
+        return vec4(0.0);
+    }
+    return texture(tex, uv / resolution);
+}
+
+vec4
+premultiply(in vec4 color) {
+    return vec4(color.rgb * color.a, color.a);
+}
+
+// Guessed AviUtl's normal blend.
+vec4
+blend(in vec4 color1, in vec4 color2) {
+    vec4 result;
+
+    float t = 1.0 - color2.a;
+    float w1 = color1.a * t;
+    float w2 = color2.a * color2.a;
+    float denominator = w1 + w2;
+    float is_zero = step(denominator, 0.0);
+    vec3 blend_result = (color1.rgb * w1 + color2.rgb * w2) / max(denominator, 0.0001);
+    result.rgb = mix(blend_result, vec3(0.0), is_zero);
+
+    result.a = color1.a + color2.a * (1.0 - color1.a);
+
+    return clamp(result, 0.0, 1.0);
+}
+
+void
+main() {
+    vec2 uv = TexCoord * resolution - pivot;
+
+    if (pass_type == 0) {
+        vec4 here = premultiply(texture(texture0, TexCoord));
+        vec4 there = premultiply(safe_texture(texture0, apply_affine(map_mat, map_pos, uv) + pivot, resolution));
+        FragColor = (here + there) * 0.5;
+        return;
+    }
+
+    if (pass_type == 1) {
+        vec4 here = texture(texture0, TexCoord);
+        vec4 there = safe_texture(texture0, apply_affine(map_mat, map_pos, uv) + pivot, resolution);
+        FragColor = (here + there) * 0.5;
+        return;
+    }
+
+    uv = apply_affine(offset_mat, offset_pos, uv);
+    vec4 color = premultiply(safe_texture(texture0, uv + pivot, resolution));
+    color += float(samples.x) * safe_texture(texture1, apply_affine(seg1_mat, seg1_pos, uv) + pivot, resolution);
+    if (samples.y != 0) {
+        color += float(samples.y) * safe_texture(texture2, apply_affine(seg2_mat, seg2_pos, uv) + pivot, resolution);
+    }
+
+    // Avoid division by zero. (See MotionBlur_K.frag)
+    float is_zero = step(color.a, 0.0);
+    color.rgb = mix(color.rgb / max(color.a, 0.0001), vec3(0.0), is_zero);
+    color.a /= float(1 + samples.x + samples.y);
+    color = clamp(color, 0.0, 1.0);
+    if (bool(is_orig_img_visible)) {
+        color = blend(color, texture(texture0, TexCoord));
+    }
+    FragColor = color;
+}